@@ -1,9 +1,18 @@
 /*
 */
+	#ifdef MCHEAP_MMAP_THRESHOLD
+		#define _GNU_SOURCE		// for mremap()
+	#endif
+
 	#include <string.h>
+	#include <stdlib.h>
 	#include <stdint.h>
 	#include <stdbool.h>
 	#include <stddef.h>
+	#include <limits.h>
+	#include <assert.h>
+
+	#include "mcheap.h"
 	
 //********************************************************************************************************
 // Local defines
@@ -28,30 +37,438 @@
 		#endif
 	#endif
 
+	#if defined(MCHEAP_ENGINE_SEGREGATED) + defined(MCHEAP_ENGINE_TLSF) + defined(MCHEAP_ENGINE_TREE) > 1
+	#error "ONLY ONE MCHEAP_ENGINE_ MAY BE DEFINED"
+	#endif
+
+	#ifdef MCHEAP_BOUNDARY_TAGS
+		#define BOUNDARY_TAGS
+	#endif
+
+//	select the free list engine, the single address ordered list is used if no other engine is defined
+	#if defined(MCHEAP_ENGINE_SEGREGATED)
+	//	one bin for each power of 2 section size, bin n holds sections of size 2^n to (2^(n+1))-1
+	//	the number of bins depends on the size of each heap
+	#elif defined(MCHEAP_ENGINE_TLSF)
+		#ifndef MCHEAP_TLSF_SL_BITS
+			#define MCHEAP_TLSF_SL_BITS 3
+		#endif
+
+		#if MCHEAP_TLSF_SL_BITS < 1 || MCHEAP_TLSF_SL_BITS > 5
+		#error "MCHEAP_TLSF_SL_BITS MUST BE 1 TO 5"
+		#endif
+
+		#if MCHEAP_ALIGNMENT & (MCHEAP_ALIGNMENT - 1)
+		#error "MCHEAP_ENGINE_TLSF REQUIRES MCHEAP_ALIGNMENT TO BE A POWER OF 2"
+		#endif
+
+	//	O(1) merging needs to find the physical neighbours of a section
+		#define BOUNDARY_TAGS
+
+	//	each first level list covers a power of 2 range of section sizes, which is divided into SL_COUNT second level lists
+	//	sections smaller than SMALL_SIZE are all in first level list 0, which is divided linearly in steps of MCHEAP_ALIGNMENT
+		#define SL_COUNT		(1 << MCHEAP_TLSF_SL_BITS)
+		#define ALIGN_SHIFT		__builtin_ctz(MCHEAP_ALIGNMENT)
+		#define FL_SHIFT		(MCHEAP_TLSF_SL_BITS + ALIGN_SHIFT)
+		#define SMALL_SIZE		((size_t)1 << FL_SHIFT)
+	//	the number of first level lists needed for a heap of size bytes
+		#define FL_COUNT(size)	(floor_log2(size) < FL_SHIFT ? 1 : floor_log2(size) - FL_SHIFT + 2)
+	#elif !defined(MCHEAP_ENGINE_TREE)
+		#define ENGINE_LIST
+	#endif
+
+	#ifdef MCHEAP_SLAB
+		#ifndef MCHEAP_SLAB_SIZE
+			#define MCHEAP_SLAB_SIZE 512
+		#endif
+
+		#ifndef MCHEAP_SLAB_MAX
+			#define MCHEAP_SLAB_MAX 128
+		#endif
+
+		#if MCHEAP_SLAB_SIZE % MCHEAP_ALIGNMENT != 0 || MCHEAP_SLAB_MAX % MCHEAP_ALIGNMENT != 0
+		#error "MCHEAP_SLAB_SIZE AND MCHEAP_SLAB_MAX MUST BE MULTIPLES OF MCHEAP_ALIGNMENT"
+		#endif
+
+		#if MCHEAP_ALIGNMENT % __SIZEOF_POINTER__ != 0
+		#error "MCHEAP_SLAB REQUIRES MCHEAP_ALIGNMENT TO BE A MULTIPLE OF THE POINTER SIZE"
+		#endif
+
+	//	one size class for each multiple of MCHEAP_ALIGNMENT up to MCHEAP_SLAB_MAX
+		#define SLAB_CLASS_COUNT	(MCHEAP_SLAB_MAX / MCHEAP_ALIGNMENT)
+
+	//	the heap is divided into chunks of MCHEAP_SLAB_SIZE, each of which can hold the start of at most one slab
+		#define SLAB_CHUNK_COUNT(size)	((size) / MCHEAP_SLAB_SIZE + 1)
+	#endif
+
+//	all public functions hold the lock while they use the heap
+	#ifdef MCHEAP_THREAD_SAFE
+		#ifndef MCHEAP_NO_PTHREAD
+			#include <pthread.h>
+		#endif
+		#define LOCK(heap)		heap_lock(heap)
+		#define UNLOCK(heap)	heap_unlock(heap)
+	#else
+		#define LOCK(heap)
+		#define UNLOCK(heap)
+	#endif
+
+	#ifdef MCHEAP_THREAD_CACHE
+		#ifndef MCHEAP_THREAD_SAFE
+		#error "MCHEAP_THREAD_CACHE REQUIRES MCHEAP_THREAD_SAFE"
+		#endif
+
+		#ifdef MCHEAP_SLAB
+		#error "MCHEAP_THREAD_CACHE AND MCHEAP_SLAB CAN'T BOTH BE DEFINED"
+		#endif
+
+		#ifndef MCHEAP_THREAD_CACHE_MAX
+			#define MCHEAP_THREAD_CACHE_MAX 256
+		#endif
+
+		#ifndef MCHEAP_THREAD_CACHE_COUNT
+			#define MCHEAP_THREAD_CACHE_COUNT 16
+		#endif
+
+		#ifndef MCHEAP_THREAD_CACHE_BYTES
+			#define MCHEAP_THREAD_CACHE_BYTES (MCHEAP_SIZE / 16)
+		#endif
+
+		#if MCHEAP_THREAD_CACHE_MAX % MCHEAP_ALIGNMENT != 0
+		#error "MCHEAP_THREAD_CACHE_MAX MUST BE A MULTIPLE OF MCHEAP_ALIGNMENT"
+		#endif
+
+		#if MCHEAP_ALIGNMENT % __SIZEOF_POINTER__ != 0
+		#error "MCHEAP_THREAD_CACHE REQUIRES MCHEAP_ALIGNMENT TO BE A MULTIPLE OF THE POINTER SIZE"
+		#endif
+
+	//	one bin for each multiple of MCHEAP_ALIGNMENT up to MCHEAP_THREAD_CACHE_MAX
+		#define CACHE_BIN_COUNT	(MCHEAP_THREAD_CACHE_MAX / MCHEAP_ALIGNMENT)
+
+	//	the number of allocations moved between a bin and the heap at once
+		#define CACHE_BATCH		((MCHEAP_THREAD_CACHE_COUNT + 1) / 2)
+	#endif
+
+//	the default heap is placed in reserved address space, and memory is committed to it as it grows
+	#ifdef MCHEAP_GROWABLE
+		#ifdef MCHEAP_ADDRESS
+		#error "MCHEAP_GROWABLE AND MCHEAP_ADDRESS CAN'T BOTH BE DEFINED"
+		#endif
+
+		#ifndef MCHEAP_GROW_SIZE
+			#define MCHEAP_GROW_SIZE 65536
+		#endif
+
+		#include <sys/mman.h>
+		#include <unistd.h>
+	#endif
+
+//	whole pages within free sections may be returned to the operating system
+	#ifdef MCHEAP_TRIM
+		#ifndef MCHEAP_TRIM_THRESHOLD
+			#define MCHEAP_TRIM_THRESHOLD (128*1024)
+		#endif
+
+		#ifndef MCHEAP_TRIM_ADVICE
+			#define MCHEAP_TRIM_ADVICE MADV_DONTNEED
+		#endif
+
+		#include <sys/mman.h>
+		#include <unistd.h>
+	#endif
+
+//	allocations of at least MCHEAP_MMAP_THRESHOLD bytes are given their own mapping
+	#ifdef MCHEAP_MMAP_THRESHOLD
+		#if MCHEAP_ALIGNMENT < 4
+		#error "MCHEAP_MMAP_THRESHOLD REQUIRES MCHEAP_ALIGNMENT TO BE AT LEAST 4"
+		#endif
+
+		#include <sys/mman.h>
+		#include <unistd.h>
+	#endif
+
+//	free sections whose content is known to be zero are flagged, so that zeroed allocations need not clear them
+	#ifdef MCHEAP_TRACK_ZERO
+		#if MCHEAP_ALIGNMENT < 8
+		#error "MCHEAP_TRACK_ZERO REQUIRES MCHEAP_ALIGNMENT TO BE AT LEAST 8"
+		#endif
+	#endif
+
+	#ifdef MCHEAP_PLACEMENT
+		#ifndef ENGINE_LIST
+		#error "MCHEAP_PLACEMENT IS ONLY SUPPORTED BY THE DEFAULT ENGINE"
+		#endif
+	#else
+		#define MCHEAP_PLACEMENT	MCHEAP_FIRST_FIT
+	#endif
+
+	#ifndef MCHEAP_COPY_BUDGET
+		#define MCHEAP_COPY_BUDGET	65536
+	#endif
+
+	#ifndef MCHEAP_COPY_RATIO
+		#define MCHEAP_COPY_RATIO	8
+	#endif
+
+	#if MCHEAP_COPY_RATIO < 1
+	#error "MCHEAP_COPY_RATIO MUST BE AT LEAST 1"
+	#endif
+
+//	allocations made through handles may be moved by mcheap_compact() while they are not locked
+	#ifdef MCHEAP_HANDLES
+		#ifndef MCHEAP_HANDLE_COUNT
+			#define MCHEAP_HANDLE_COUNT 16
+		#endif
+	#endif
+
+//	a failed allocation continues the incremental defragmentation for up to MCHEAP_AUTO_DEFRAG_BUDGET bytes and tries again
+	#ifdef MCHEAP_AUTO_DEFRAG
+		#ifndef MCHEAP_HANDLES
+		#error "MCHEAP_AUTO_DEFRAG REQUIRES MCHEAP_HANDLES"
+		#endif
+		#ifndef MCHEAP_AUTO_DEFRAG_BUDGET
+			#define MCHEAP_AUTO_DEFRAG_BUDGET	16384
+		#endif
+	#endif
+
+//	the size fields of each section are the smallest type which can hold the size of any heap of MCHEAP_SIZE bytes
+//	one bit less is available if MCHEAP_ALIGNMENT is 1, as the highest bit holds the free flag
+	#ifdef MCHEAP_COMPACT_HEADERS
+		#ifdef MCHEAP_MMAP_THRESHOLD
+		#error "MCHEAP_COMPACT_HEADERS AND MCHEAP_MMAP_THRESHOLD CAN'T BOTH BE DEFINED"
+		#endif
+
+		#if MCHEAP_SIZE <= (MCHEAP_ALIGNMENT > 1 ? 0xFFFF : 0x7FFF)
+			typedef uint16_t	section_size_t;
+		#elif MCHEAP_SIZE <= (MCHEAP_ALIGNMENT > 1 ? 0xFFFFFFFF : 0x7FFFFFFF)
+			typedef uint32_t	section_size_t;
+		#else
+			typedef size_t		section_size_t;
+		#endif
+
+	//	the default engine links free sections by their offset from the control block, 0 is the end of the list
+		#ifdef ENGINE_LIST
+			#define COMPACT_LINKS
+		#endif
+	#else
+		typedef size_t			section_size_t;
+	#endif
+
+	#ifdef COMPACT_LINKS
+		typedef section_size_t			free_link_t;
+		#define LINK_TO_FREE(heap, link)	((link) ? FREECAST((uint8_t*)(heap) + (link)) : NULL)
+		#define FREE_TO_LINK(heap, ptr)		((ptr) ? (free_link_t)((uint8_t*)(ptr) - (uint8_t*)(heap)) : 0)
+	//	the control block is within the range of the links
+		#define HEAP_SPAN(reserve, control)	(reserve)
+	#else
+		typedef struct free_struct*		free_link_t;
+		#define LINK_TO_FREE(heap, link)	(link)
+		#define FREE_TO_LINK(heap, ptr)		(ptr)
+		#define HEAP_SPAN(reserve, control)	((reserve) - (control))
+	#endif
+	#define FIRST_FREE(heap)			LINK_TO_FREE(heap, (heap)->first_free)
+	#define NEXT_FREE(heap, free_ptr)	LINK_TO_FREE(heap, (free_ptr)->next_ptr)
+
 	struct free_struct
 	{
-		size_t				size;		// size of empty content[] following this structure &content[size] will address the next used_struct/free_struct
-		struct free_struct*	next_ptr;	// next free
+		section_size_t		size;		// size of empty content[] following this structure &content[size] will address the next used_struct/free_struct
+	#ifdef BOUNDARY_TAGS
+		section_size_t		prev_size;	// total size of the section below, or 0 if this is the first section
+	#endif
+	#ifdef MCHEAP_ENGINE_TREE
+		struct free_struct*	left_ptr;	// subtree of lower addressed free sections
+		struct free_struct*	right_ptr;	// subtree of higher addressed free sections
+		size_t				max_size;	// largest total section size in this subtree
+		size_t				height;		// height of this subtree (size_t, so that content[] follows without padding)
+	#else
+		free_link_t			next_ptr;	// next free
+	#endif
+	#ifdef MCHEAP_ENGINE_TLSF
+		struct free_struct*	prev_ptr;	// previous free in the same list
+	#endif
 		// addresses memory after the structure & aligns the size of the structure
 		uint8_t		content[0] __attribute__((aligned(MCHEAP_ALIGNMENT)));
 	};
 
 	struct used_struct
 	{
-		size_t		size;				// size of content[] following this structure &content[size] will address the next used_struct/free_struct
+		section_size_t	size;			// size of content[] following this structure &content[size] will address the next used_struct/free_struct
+	#ifdef BOUNDARY_TAGS
+		section_size_t	prev_size;		// total size of the section below, or 0 if this is the first section
+	#endif
 		// addresses memory after the structure & aligns the size of the structure
 		uint8_t		content[0] __attribute__((aligned(MCHEAP_ALIGNMENT)));
 	};
 
+//	Flags held in the size field of a section, which would otherwise always be a multiple of MCHEAP_ALIGNMENT.
+//	If MCHEAP_ALIGNMENT is 1, the highest bit of the size is used instead.
+//	Adding or subtracting a multiple of MCHEAP_ALIGNMENT to the size field preserves the flags.
+	#define SECTION_SIZE_MAX	((size_t)(section_size_t)~(size_t)0)
+	#if MCHEAP_ALIGNMENT > 1
+		#define FLAG_FREE	((size_t)1)		// set for every section in the free list
+	#else
+		#define FLAG_FREE	(SECTION_SIZE_MAX & ~(SECTION_SIZE_MAX >> 1))
+		#if MCHEAP_SIZE > (SIZE_MAX >> 1)
+		#error "MCHEAP_SIZE IS TOO LARGE FOR A SIZE FLAG"
+		#endif
+	#endif
+
+//	the largest buffer which can be used for a heap, the size of every section must leave the flags clear
+	#define HEAP_SIZE_MAX	(SECTION_SIZE_MAX & ~FLAG_FREE & ~(size_t)(MCHEAP_ALIGNMENT - 1))
+	#ifdef MCHEAP_MMAP_THRESHOLD
+		#define FLAG_MAPPED	((size_t)2)		// set for an allocation with it's own mapping, which is not in any region
+	#else
+		#define FLAG_MAPPED	((size_t)0)
+	#endif
+	#ifdef MCHEAP_TRACK_ZERO
+		#define FLAG_ZERO	((size_t)4)		// set for a free section whose content (not it's meta data) is all zero
+	#else
+		#define FLAG_ZERO	((size_t)0)
+	#endif
+	#define FLAG_MASK	(FLAG_FREE | FLAG_MAPPED | FLAG_ZERO)
+
+#ifdef MCHEAP_SLAB
+//	A slab is the content of a used section of MCHEAP_SLAB_SIZE bytes, and holds objects of a single size class
+	struct slab_struct
+	{
+		struct slab_struct*	next_ptr;		// next slab of the same class with free objects
+		struct slab_struct*	prev_ptr;		// previous slab of the same class with free objects
+		void*				free_objects;	// list of free objects, the first bytes of each free object address the next
+		size_t				object_size;	// size of each object
+		size_t				used_count;		// number of objects allocated
+		// addresses the objects
+		uint8_t		content[0] __attribute__((aligned(MCHEAP_ALIGNMENT)));
+	};
+
+//	the space for objects in each slab
+	#define SLAB_CONTENT_SIZE	(MCHEAP_SLAB_SIZE - sizeof(struct used_struct) - sizeof(struct slab_struct))
+#endif
+
+#ifdef MCHEAP_HANDLES
+//	A handle holds the address of a movable allocation, which is only moved while the handle isn't locked
+//	An unused handle is all zero, the used handles of a heap are linked in order of the address of their allocations
+	struct mcheap_handle_struct
+	{
+		void*				section;		// content of the allocation, NULL if the handle is unused
+		unsigned			lock_count;		// number of times the handle is locked
+		mcheap_move_hook_t	hook;			// called when the allocation is moved, NULL unless it was registered with mcheap_register()
+		void*				arg;			// passed to hook
+		struct mcheap_handle_struct*	next;	// the used handle with the next higher allocation, NULL for the highest
+	};
+#endif
+
+#ifdef MCHEAP_THREAD_CACHE
+//	Allocations which have been freed by a thread, but are still used sections of the heap
+	struct thread_cache_struct
+	{
+		void*		bins[CACHE_BIN_COUNT];		// list of allocations for each content size, the first bytes of each address the next
+		int			counts[CACHE_BIN_COUNT];	// number of allocations in each bin
+		size_t		bytes;						// total content size of all allocations
+		mcheap_t*	heap;						// the heap which all allocations in the cache belong to
+		unsigned	generation;					// the cache is discarded if this doesn't match the generation of the heap
+		bool		registered;					// true once the cache will be flushed on thread exit
+	};
+#endif
+
+//	The control block of a heap, which is placed at the start of the buffer given to mcheap_init()
+//	It is followed by the tables of the engine and slab layer, which are sized for the heap, and then the sections
+	struct mcheap_struct
+	{
+		uint8_t*	start;		// the first section
+		uint8_t*	end;		// the first byte past the last section
+	#ifdef MCHEAP_GROWABLE
+		uint8_t*	limit;		// the end of the reserved space, which end may grow up to
+	#endif
+	#ifdef BOUNDARY_TAGS
+		size_t		top_size;	// total size of the last section, the boundary tag which end would have if it were a section
+	#endif
+
+		struct mcheap_struct*	first_region;	// the region with the highest priority, which may be the heap itself
+		struct mcheap_struct*	next_region;	// the region with the next lower priority, NULL for the last
+		int						priority;		// regions with a higher priority are used first
+		size_t					copy_budget;	// the most bytes reallocate copies to move a section which could be resized in place
+
+	#ifdef ENGINE_LIST
+		free_link_t			 	first_free;
+		mcheap_placement_t		placement;
+		struct free_struct*		rover;			// where the next MCHEAP_NEXT_FIT search starts, NULL for the start of the list
+	#endif
+
+	#ifdef MCHEAP_ENGINE_SEGREGATED
+		struct free_struct**	bins;			// address ordered list of free sections for each size class, bin_count entries
+		int						bin_count;		// one more than the highest bin any section of this heap can be in
+		size_t					bin_map;		// bit n is set if bins[n] is not empty
+	#endif
+
+	#ifdef MCHEAP_ENGINE_TLSF
+		struct free_struct*		(*tlsf_lists)[SL_COUNT];	// unordered list of free sections for each size class, fl_count rows
+		uint32_t*				sl_map;						// bit n of sl_map[f] is set if tlsf_lists[f][n] is not empty
+		size_t					fl_map;						// bit n is set if sl_map[n] is not 0
+		int						fl_count;					// number of first level lists
+	#endif
+
+	#ifdef MCHEAP_ENGINE_TREE
+		struct free_struct*		tree_root;		// root of the address ordered tree of free sections
+	#endif
+
+	#ifdef MCHEAP_THREAD_SAFE
+		struct mcheap_struct*	owner;			// the heap which this region belongs to, only the lock of the owner is used
+		mcheap_lock_hook_t		lock_hook;		// NULL for the default lock
+		mcheap_lock_hook_t		unlock_hook;
+		void*					lock_arg;
+		#ifndef MCHEAP_NO_PTHREAD
+		pthread_mutex_t			default_mutex;
+		#endif
+	#endif
+
+	#ifdef MCHEAP_THREAD_CACHE
+		unsigned				generation;		// changed each time the heap is initialized
+	#endif
+
+	#ifdef MCHEAP_SLAB
+		struct slab_struct*		slab_partial[SLAB_CLASS_COUNT];	// list of slabs with free objects for each size class
+		struct slab_struct**	slab_map;						// the slab starting within each chunk of the heap, if any
+	#endif
+
+	#ifdef MCHEAP_TRACK_ZERO
+		bool					anonymous;		// the heap is in a private anonymous mapping made by mcheap_reserve(), whose released pages read back as zero
+	#endif
+
+	#ifdef MCHEAP_HANDLES
+		struct mcheap_handle_struct*	handles;	// MCHEAP_HANDLE_COUNT entries, NULL for a region added to another heap, which has none
+		struct mcheap_handle_struct*	first_handle;	// the used handle with the lowest allocation, NULL if none are used
+		void*							defrag_cursor;	// the allocation mcheap_defrag_step() continues after, NULL to start from the lowest
+	#endif
+	};
+
+//	evaluate the size of content[] of a used or free section pointed to by arg1, without any flags
+	#define CONTENT_SIZE(arg1)	((arg1)->size & ~FLAG_MASK)
+
 //	evaluate the total size of a used or free section (including it's meta data) pointed to by arg1
 //	arg1 must have correct type, used_struct* or free_struct*, not void*
-	#define SECTION_SIZE(arg1)	(sizeof(*(arg1))+(arg1)->size)
+	#define SECTION_SIZE(arg1)	(sizeof(*(arg1))+CONTENT_SIZE(arg1))
 
 //	address the next section, or, the first byte past heap space if there is no next section
 //	arg1 must have correct type (not void*)
-	#define SECTION_AFTER(arg1)	((void*)(&(arg1)->content[(arg1)->size]))
+	#define SECTION_AFTER(arg1)	((void*)(&(arg1)->content[CONTENT_SIZE(arg1)]))
+
+//	update the boundary tag of the section following arg1, after the size of arg1 has changed
+//	arg1 must have correct type (not void*)
+	#ifdef BOUNDARY_TAGS
+		#define TAG_NEXT(heap, arg1)	tag_section(heap, SECTION_AFTER(arg1), SECTION_SIZE(arg1))
+	#else
+		#define TAG_NEXT(heap, arg1)	((void)(heap))
+	#endif
+
+//	keep the zero flag of free section arg1, which is about to absorb the section after it, only if both are zero
+	#ifdef MCHEAP_TRACK_ZERO
+		#define ZERO_MERGE(arg1)	zero_merge(arg1)
+	#else
+		#define ZERO_MERGE(arg1)	((void)0)
+	#endif
 
-	#define END_OF_HEAP (&heap_space[MCHEAP_SIZE])
+//	the first byte past the last section of a heap
+	#define END_OF_HEAP(heap)	((heap)->end)
 
 //	pointer casts
 	#define USEDCAST(arg1)	((struct used_struct*)(arg1))
@@ -66,6 +483,7 @@
 	})
 
 	#define SMALLEST_OF(x,y) ((x)<(y) ? (x):(y))
+	#define LARGEST_OF(x,y) ((x)>(y) ? (x):(y))
 
 //********************************************************************************************************
 // Public variables
@@ -75,42 +493,102 @@
 // Private variables
 //********************************************************************************************************
 
-	#ifdef MCHEAP_ADDRESS
+	#if defined(MCHEAP_ADDRESS)
 		static uint8_t* heap_space = (uint8_t*)MCHEAP_ADDRESS;
-	#else
+	#elif !defined(MCHEAP_GROWABLE)
 		static uint8_t	heap_space[MCHEAP_SIZE] __attribute__((aligned(MCHEAP_ALIGNMENT)));
 	#endif
 
-	static bool	initialized = false;
+//	the heap used by the global functions, placed in heap_space (or reserved address space if MCHEAP_GROWABLE) on first use
+	static mcheap_t*	default_heap;
+	#if defined(MCHEAP_THREAD_SAFE) && !defined(MCHEAP_NO_PTHREAD)
+		static pthread_once_t	default_heap_once = PTHREAD_ONCE_INIT;
+	#endif
 
-	static struct free_struct* 	first_free;
+	#ifdef MCHEAP_THREAD_CACHE
+		static __thread struct thread_cache_struct	thread_cache;
+		static unsigned 							cache_generation;	// incremented each time any heap is initialized
+		#ifndef MCHEAP_NO_PTHREAD
+		static pthread_once_t						cache_key_once = PTHREAD_ONCE_INIT;
+		static pthread_key_t						cache_key;			// used to flush the cache of each thread on exit
+		#endif
+	#endif
 
 //********************************************************************************************************
 // Private prototypes
 //********************************************************************************************************
 
-	static void initialize(void);
+//	Return the default heap, creating it on first use
+	static mcheap_t* get_default_heap(void);
+	static void default_heap_init(void);
+
+//	Return the size of the control block, and the tables which follow it, for a heap in a buffer of size bytes
+//	region is true for a region to be added to another heap, which has no tables for the heap as a whole
+	static size_t control_size(size_t size, bool region);
+
+//	Create a heap, or a region to be added to another heap, in a buffer of size bytes, with tables sized for it to grow to reserve bytes
+	static mcheap_t* heap_create(void* buffer, size_t size, size_t reserve, bool zeroed, bool region);
 
-// 	Internal allocate/reallocate/free functions 
-	static void* allocate(size_t size);
-	static void* reallocate(void* section, size_t new_size);
-	static void* internal_free(void* section);
+	static void initialize(mcheap_t *heap);
+
+	#ifdef MCHEAP_GROWABLE
+//	Commit more reserved space to the top of the heap, enough to allocate size bytes, return false if it can't grow
+	static bool heap_grow(mcheap_t *heap, size_t size);
+	#endif
+
+	#ifdef MCHEAP_TRIM
+//	Return the whole pages within the content of a free section to the operating system, return the number of bytes released
+	static size_t free_trim(mcheap_t *heap, struct free_struct *free_ptr);
+
+//	Trim every free section of the heap, return the number of bytes released
+	static size_t heap_trim(mcheap_t *heap);
+
+		#if MCHEAP_TRIM_THRESHOLD
+//	Trim a free section which has just absorbed the released span from start to end, if it now has at least MCHEAP_TRIM_THRESHOLD bytes
+	static void free_trim_released(mcheap_t *heap, struct free_struct *free_ptr, void* start, void* end);
+		#endif
+	#endif
+
+	#if defined(MCHEAP_GROWABLE) || defined(MCHEAP_TRIM) || defined(MCHEAP_MMAP_THRESHOLD)
+//	Round up size to a multiple of the page size
+	static size_t page_align(size_t sz);
+	#endif
+
+// 	Internal allocate/reallocate/free functions, allocate() clears the content if zeroed is true
+	static void* allocate(mcheap_t *heap, size_t size, bool zeroed);
+	static void* reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size);
+	static void* internal_free(mcheap_t *heap, void* section);
+
+//	Allocate size bytes with the content aligned to align, which must be a power of 2 and a multiple of MCHEAP_ALIGNMENT
+	static void* allocate_aligned(mcheap_t *heap, size_t size, size_t align);
+
+//	Return the padding needed before content to align it to align, which is either 0 or large enough to hold a free section
+	static size_t aligned_padding(void* content, size_t align);
+
+//	Allocate count sections of the given sizes, carved consecutively from one free section, return false if no free section can hold them all
+	static bool allocate_batch(mcheap_t *heap, const size_t *sizes, void** sections, size_t count);
+
+//	Free count used sections, which must be sorted by address, the array is overwritten
+	static void free_batch(mcheap_t *heap, void** sections, size_t count);
+
+//	Resize a used section without moving it, return NULL if it can't be resized in place
+	static void* resize_in_place(mcheap_t *heap, void* section, size_t new_size);
 
 // relocate of realloc
 // dest_ptr must be a suitable free section capable of allocating new_size bytes.
 // removes dest_ptr from the free list, moves src_ptr to dest_ptr, and adds src_ptr to the free list
-// preserves at most new_size bytes
+// preserves at most preserve_size bytes, which must not be more than the new size
 // returns the new used section at dest_ptr
-	static struct used_struct* relocate(struct free_struct* dest_ptr, struct used_struct* src_ptr, size_t new_size);
+	static struct used_struct* relocate(mcheap_t *heap, struct free_struct* dest_ptr, struct used_struct* src_ptr, size_t preserve_size);
 
 // 	Return true if section is in the free list
-	static bool in_free_list(struct free_struct *x);
+	static bool in_free_list(mcheap_t *heap, struct free_struct *x);
 
 // 	Shrink used section so that it's content is reduced to the new_size.
 // 	This will only happen if doing so allows a new free section to be created.
 // 	new_size should be pre-aligned by the caller
 // 	If created, the new free section will be inserted into the free list, and merged if possible
-	static void used_shrink(struct used_struct *used_ptr, size_t new_size);
+	static void used_shrink(mcheap_t *heap, struct used_struct *used_ptr, size_t new_size);
 
 // 	Convert a used section to a free section, does not insert into the free list
 // 	Returns the result
@@ -123,484 +601,3700 @@
 // 	Extend a used section into a lower free section, also moves content limited to 'preserve_size' bytes
 // 	Free section must be removed from the free list before calling this function
 // 	Returns the resulting used section
-	static struct used_struct* used_extend_down(struct free_struct *free_ptr, struct used_struct *used_ptr, size_t preserve_size);
+	static struct used_struct* used_extend_down(mcheap_t *heap, struct free_struct *free_ptr, struct used_struct *used_ptr, size_t preserve_size);
 
 // 	Extend a used section into a higher free section
 // 	The higher free section must be removed from the free list before calling this function
-	static struct used_struct* used_extend_up(struct used_struct *used_ptr);
+	static struct used_struct* used_extend_up(mcheap_t *heap, struct used_struct *used_ptr);
 
 // 	Find free below
 // 	Find the last free section before target section (either type), if there is one
 // 	Otherwise return NULL
-	static struct free_struct* find_free_below(void* target);
+	static struct free_struct* find_free_below(mcheap_t *heap, void* target);
 
 // 	Walk the free list for allocation (or re-allocation)
 // 	Find a free section capable of holding 'size' bytes as a used section
-	static struct free_struct* free_walk(size_t size);
+	static struct free_struct* free_walk(mcheap_t *heap, size_t size);
 
 // 	Insert a free section into the free list
 // 	Walks the free list to find the insertion point
-	static void free_insert(struct free_struct *new_free);
+	static void free_insert(mcheap_t *heap, struct free_struct *new_free);
 
 // 	Remove a free section from the free list
 // 	Walks the free list to find the link to modify
-	static void free_remove(struct free_struct *free_ptr);
+	static void free_remove(mcheap_t *heap, struct free_struct *free_ptr);
 
-// 	Merge free section with adjacent free sections
+	#ifndef BOUNDARY_TAGS
+// 	Merge free section with adjacent free sections, and return the resulting section
 // 	All free sections must already be in the free list
-	static void free_merge(struct free_struct *free_ptr);
+	static struct free_struct* free_merge(mcheap_t *heap, struct free_struct *free_ptr);
+	#endif
+
+// 	Return a section to the free list, and merge it with adjacent free sections
+	static void free_release(mcheap_t *heap, struct free_struct *free_ptr);
+
+// 	Return count free sections, sorted by address, to the free list, and merge them with adjacent free sections
+	static void free_release_sorted(mcheap_t *heap, void** sections, size_t count);
+
+// 	Grow a free section which is in the free list by size bytes
+	static void free_grow(mcheap_t *heap, struct free_struct *free_ptr, size_t size);
 
 // 	Merge free section into the next free section if possible
 // 	merge does not destroy id_ info for either section, but overwrites second sections key with KEY_MERGED
-	static void free_merge_up(struct free_struct *free_ptr);
+	static void free_merge_up(mcheap_t *heap, struct free_struct *free_ptr);
 
 // 	Find largest free block. Used for tracking heap headroom.
-	static size_t free_find_largest(void);
+	static size_t free_find_largest(mcheap_t *heap);
+
+// 	Return the total allocatable size of all free sections.
+	static size_t free_find_total(mcheap_t *heap);
 
 // 	Heap test, return true if the heap is intact.
-	static bool heap_test(void);
+	static bool heap_test(mcheap_t *heap);
 
 //	Round up size to a multiple of MCHEAP_ALIGNMENT
 	static size_t align_size(size_t sz);
 
-// Ensure that size is aligned, AND that the used section will be large enough to return to the free list
-	static size_t enforce_minimum_allocation_size(size_t sz);
+//	Compare the addresses pointed to by a and b, for qsort()
+	static int address_compare(const void* a, const void* b);
 
-// 	Return true, if the used section can extend down into the free section to acheive the desired size
-	static bool used_section_can_extend_down(struct free_struct* free_ptr, struct used_struct* used_ptr, size_t desired_size);
+	#if defined(MCHEAP_ENGINE_SEGREGATED) || defined(MCHEAP_ENGINE_TLSF)
+//	Return the index of the highest set bit, x must not be 0
+	static int floor_log2(size_t x);
 
-// Return true, if the used section can extend up into a free section to acheive the desired size
-	static bool used_section_can_extend_up(struct used_struct* used_ptr, size_t desired_size);
+//	Return the index of the lowest set bit, x must not be 0
+	static int lowest_bit(size_t x);
+	#endif
 
-//********************************************************************************************************
-// Public functions
-//********************************************************************************************************
+	#ifdef MCHEAP_ENGINE_SEGREGATED
+//	Return the bin a free section belongs in
+	static int bin_of(struct free_struct *free_ptr);
+	#endif
 
-void* mcheap_allocate(size_t size)
-{
-	return allocate(size);
-}
+	#ifdef MCHEAP_ENGINE_TLSF
+//	Return the first and second level list indexes for a section size
+	static void tlsf_mapping(size_t size, int *fl, int *sl);
+	#endif
 
-void* mcheap_reallocate(void* section, size_t new_size)
-{
-	return reallocate(section, new_size);
-}
+	#ifdef MCHEAP_ENGINE_TREE
+//	Insert new_free into the subtree at node, return the new root of the subtree
+	static struct free_struct* tree_insert(struct free_struct *node, struct free_struct *new_free);
 
-void* mcheap_free(void* section)
-{
-	return internal_free(section);
-}
+//	Remove free_ptr from the subtree at node, return the new root of the subtree
+	static struct free_struct* tree_remove(struct free_struct *node, struct free_struct *free_ptr);
 
-size_t mcheap_largest_free(void)
-{
-	return free_find_largest();
-}
+//	Remove the lowest section from the subtree at node, return the new root of the subtree
+	static struct free_struct* tree_remove_lowest(struct free_struct *node);
 
-bool mcheap_is_intact(void)
-{
-	return heap_test();
-}
+//	Update the largest section sizes on the path from node to free_ptr, after free_ptr has changed size
+	static void tree_refresh(struct free_struct *node, struct free_struct *free_ptr);
 
-void mcheap_reinit(void)
-{
-	initialize();
-}
+//	Restore the balance of the subtree at node, return the new root of the subtree
+	static struct free_struct* tree_rebalance(struct free_struct *node);
 
-//********************************************************************************************************
-// Private functions
-//********************************************************************************************************
+//	Rotate the subtree at node, return the new root of the subtree
+	static struct free_struct* tree_rotate_left(struct free_struct *node);
+	static struct free_struct* tree_rotate_right(struct free_struct *node);
 
-static void initialize(void)
-{
-	initialized = true;
-	first_free = (void*)heap_space;		//init head of the free list
-	first_free->size = MCHEAP_SIZE - sizeof(struct free_struct);
-	first_free->next_ptr = NULL;
-}
+//	Update the height and largest section size of node from it's children
+	static void tree_update(struct free_struct *node);
 
-static void* allocate(size_t size)
-{
-	struct free_struct *free_ptr;
-	struct used_struct *used_ptr;
-	void* retval=NULL;
+//	Return the height of the subtree at node, 0 for an empty subtree
+	static int tree_height(struct free_struct *node);
+	#endif
 
-	if(!initialized)
-		initialize();
+	#ifdef MCHEAP_THREAD_SAFE
+//	Take and release the heap lock, using the lock hooks if they have been set
+	static void heap_lock(mcheap_t *heap);
+	static void heap_unlock(mcheap_t *heap);
+	#endif
 
-	size = enforce_minimum_allocation_size(size);
+//	Allocate, reallocate and free in the regions of a heap
+	static void* region_allocate(mcheap_t *heap, size_t size);
+	static void* region_reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size);
+	static void region_free(mcheap_t *heap, void* section);
 
-	free_ptr = free_walk(size);
-	if(free_ptr)
-	{
-		free_remove(free_ptr);				//remove from the free list
-		used_ptr = free_to_used(free_ptr);	//convert to used section
-		used_shrink(used_ptr, size);		//shrink to required size
-		retval = used_ptr->content;
-	};
+//	Resize a section of a heap without moving it, return false if it can't be resized in place
+	static bool region_resize(mcheap_t *heap, void* section, size_t new_size);
 
-	return retval;
-}
+//	Allocate and free batches of sections in the regions of a heap
+	static bool region_allocate_batch(mcheap_t *heap, const size_t *sizes, void** sections, size_t count);
+	static void region_free_batch(mcheap_t *heap, void** sections, size_t count);
 
-static void* reallocate(void* section, size_t new_size)
-{
-	struct free_struct* free_ptr;
-	struct free_struct* relocation_ptr;
-	struct used_struct* used_ptr;
-	struct used_struct* new_used_ptr = NULL;
-	void* retval = NULL;
+//	Allocate in the regions of a heap, with the content cleared
+	static void* region_allocate_zeroed(mcheap_t *heap, size_t size);
 
-	if(!initialized)
-		initialize();
+//	Allocate and reallocate in the regions of a heap, with the content aligned to align
+	static void* region_allocate_aligned(mcheap_t *heap, size_t size, size_t align);
+	static void* region_reallocate_aligned(mcheap_t *heap, void* section, size_t new_size, size_t align);
 
-	if(section == NULL)
-		retval = allocate(new_size);					//if section == NULL just call allocate()
-	else if(new_size == 0)
-		retval = internal_free(section);
-	else
-	{
-		new_size = enforce_minimum_allocation_size(new_size);
-		used_ptr = container_of(section, struct used_struct, content);
+//	Move a section to a new allocation of new_size bytes aligned to align in any region, or it's own mapping, copying at most preserve_size bytes, return NULL on failure
+	static void* region_move(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size, size_t align);
 
-		// find space for new allocation
-		relocation_ptr = free_walk(new_size);
+//	Return the region of a heap which holds ptr, or NULL if ptr isn't in the heap
+	static mcheap_t* region_of(mcheap_t *heap, void* ptr);
 
-		// relocate to a lower address? (1st preference to minimize fragmentation)
-		if(relocation_ptr && (void*)relocation_ptr < (void*)used_ptr)
-			new_used_ptr = relocate(relocation_ptr, used_ptr, new_size);
+	#ifdef MCHEAP_MMAP_THRESHOLD
+//	Allocate, reallocate and free allocations with their own mapping
+	static void* map_allocate(size_t size);
+	static void* map_reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size);
+	static void map_free(void* section);
 
-		else
-		{
-			free_ptr = find_free_below(used_ptr); 
-			if(used_section_can_extend_down(free_ptr, used_ptr, new_size)) // 2nd preference
-			{
-				free_remove(free_ptr);
-				new_used_ptr = used_extend_down(free_ptr, used_ptr, new_size);
-			}
-			else if(new_size <= used_ptr->size)	//shrink in place? 3rd preference
-				new_used_ptr = used_ptr;
-			else if(used_section_can_extend_up(used_ptr, new_size))	//4th preference
-			{
-				free_remove(SECTION_AFTER(used_ptr));
-				new_used_ptr = used_extend_up(used_ptr);
-			}
-			else if(relocation_ptr)
-				new_used_ptr = relocate(relocation_ptr, used_ptr, new_size);	// 5th preference, relocate to higher address
-		};
+//	Resize an allocation with it's own mapping without moving it, return NULL if it can't be resized in place
+	static void* map_resize(void* section, size_t new_size);
 
-		// Shrink the new used section if possible
-		if(new_used_ptr)
-		{
-			used_shrink(new_used_ptr, new_size);
-			retval = new_used_ptr->content;
-		};
+//	Return true if an allocation has it's own mapping
+	static bool is_mapped(void* section);
+	#endif
+
+	#ifdef MCHEAP_HANDLES
+//	Return an unused handle of a heap, or NULL if all are in use
+	static struct mcheap_handle_struct* handle_unused(mcheap_t *heap);
+
+//	Return the handle whose allocation has the lowest address above after, or NULL if there is none
+	static struct mcheap_handle_struct* handle_next(mcheap_t *heap, void* after);
+
+//	Link a handle which has just been given an allocation into the used handles, in order of address
+	static void handle_insert(mcheap_t *heap, struct mcheap_handle_struct *handle);
+
+//	Unlink a handle from the used handles
+	static void handle_unlink(mcheap_t *heap, struct mcheap_handle_struct *handle);
+
+//	Move the allocation of an unlocked handle to a lower address if possible, return the number of bytes copied
+	static size_t handle_move(mcheap_t *heap, struct mcheap_handle_struct *handle);
+
+//	Move unlocked movable allocations down in order of address, starting after *cursor, until budget bytes have been copied
+//	If wanted is not 0, also stop once a region has a free section of at least wanted bytes. The heap lock must be held
+	static size_t handle_compact(mcheap_t *heap, size_t budget, size_t wanted, void** cursor);
+
+//	Continue the incremental defragmentation of the heap, as handle_compact() does from the saved cursor, return the number of bytes copied
+	static size_t defrag_step(mcheap_t *heap, size_t max_bytes, size_t wanted);
+	#endif
+
+	#ifdef MCHEAP_THREAD_CACHE
+//	Allocate, reallocate and free through the calling threads cache
+	static void* cache_allocate(mcheap_t *heap, size_t size);
+	static void* cache_reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size);
+	static void cache_free(mcheap_t *heap, void* section, size_t content_size);
+
+//	Return up to count allocations from a bin to the heap, the heap lock must be held
+	static void cache_flush_bin(mcheap_t *heap, int bin, int count);
+
+//	Return all allocations in the cache to the heap, the heap lock must be held
+	static void cache_flush(struct thread_cache_struct *cache);
+
+//	Discard the cache if the heap has been re-initialized, and arrange for it to be flushed when the thread exits
+//	The heap lock must not be held
+	static void cache_prepare(mcheap_t *heap);
+
+//	Add an allocation to the cache, in the bin for content_size, it must fit in the cache
+	static void cache_push(void* section, size_t content_size);
+
+//	Return the bin for a content size, which must be aligned and not exceed MCHEAP_THREAD_CACHE_MAX
+	static int cache_bin(size_t content_size);
+
+		#ifndef MCHEAP_NO_PTHREAD
+//	Called on thread exit with the exiting threads cache
+	static void cache_destructor(void* cache);
+
+//	Create the key used to call cache_destructor()
+	static void cache_key_create(void);
+		#endif
+	#endif
+
+	#ifdef MCHEAP_SLAB
+//	Allocate an object from the slab layer, returns NULL if size is too large or no slab can be created
+	static void* slab_allocate(mcheap_t *heap, size_t size);
+
+//	Reallocate an object of a slab, moving it if the new size doesn't fit it's size class
+	static void* slab_reallocate(mcheap_t *heap, struct slab_struct *slab, void* object, size_t new_size, size_t preserve_size);
+
+//	Return an object to it's slab, and release the slab to the heap if it becomes empty
+	static void slab_free(mcheap_t *heap, struct slab_struct *slab, void* object);
+
+//	Return the slab holding an allocation, or NULL if the allocation was made from the heap
+	static struct slab_struct* slab_of(mcheap_t *heap, void* ptr);
+
+//	Allocate a new slab from the heap for a size class, and add it to the list of slabs with free objects
+	static struct slab_struct* slab_create(mcheap_t *heap, int size_class);
+
+//	Unlink an empty slab from it's class and return it to the heap
+	static void slab_release(mcheap_t *heap, struct slab_struct *slab);
+
+//	Add or remove a slab from the list of slabs with free objects in it's class
+	static void slab_link(mcheap_t *heap, struct slab_struct *slab);
+	static void slab_unlink(mcheap_t *heap, struct slab_struct *slab);
+
+//	Return the size class for an allocation size, size must not exceed MCHEAP_SLAB_MAX
+	static int slab_class(size_t size);
+
+//	Return the heap chunk in which ptr lies
+	static size_t slab_chunk(mcheap_t *heap, void* ptr);
+	#endif
+
+	#ifdef BOUNDARY_TAGS
+//	Set the boundary tag of a section to the total size of the section below it
+//	Does nothing if section is the end of the heap
+	static void tag_section(mcheap_t *heap, void *section, size_t prev_size);
+	#endif
+
+// Ensure that size is aligned, AND that the used section will be large enough to return to the free list
+	static size_t enforce_minimum_allocation_size(size_t sz);
+
+	#ifndef NDEBUG
+//	Return true if an allocation of size bytes fits in section (or section is NULL), to check the size given to a sized free or reallocate
+	static bool size_fits(mcheap_t *heap, void* section, size_t size);
+	#endif
+
+	#ifdef MCHEAP_TRACK_ZERO
+//	Keep the zero flag of a free section which is about to absorb the section after it, only if both are zero
+	static void zero_merge(struct free_struct *free_ptr);
+	#endif
+
+// 	Return true, if moving a section down by distance bytes is worth copying copy_size bytes of it's content
+	static bool worth_moving(mcheap_t *heap, size_t copy_size, size_t distance);
+
+// 	Return true, if the used section can extend down into the free section to acheive the desired size
+	static bool used_section_can_extend_down(struct free_struct* free_ptr, struct used_struct* used_ptr, size_t desired_size);
+
+// Return true, if the used section can extend up into a free section to acheive the desired size
+	static bool used_section_can_extend_up(mcheap_t *heap, struct used_struct* used_ptr, size_t desired_size);
+
+// 	Return true, if the used section can extend both down into the free section, and up into a free section, to acheive the desired size
+	static bool used_section_can_extend_both(mcheap_t *heap, struct free_struct* free_ptr, struct used_struct* used_ptr, size_t desired_size);
+
+//********************************************************************************************************
+// Public functions
+//********************************************************************************************************
+
+mcheap_t* mcheap_init(void* buffer, size_t size)
+{
+	return heap_create(buffer, size, size, false, false);
+}
+
+mcheap_t* mcheap_reserve(size_t size)
+{
+	mcheap_t *heap = NULL;
+#ifdef MCHEAP_GROWABLE
+	size_t commit = SMALLEST_OF(size, page_align(control_size(size, false) + MCHEAP_GROW_SIZE));
+	void* space = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if(space != MAP_FAILED)
+	{
+		if(mprotect(space, commit, PROT_READ | PROT_WRITE) == 0)
+			heap = heap_create(space, commit, size, true, false);	// new mappings are zero filled
+		if(!heap)
+			munmap(space, size);
+	#ifdef MCHEAP_TRACK_ZERO
+		else
+			heap->anonymous = true;
+	#endif
+	};
+#else
+	(void)size;
+#endif
+	return heap;
+}
+
+void* mcheap_heap_allocate(mcheap_t *heap, size_t size)
+{
+	void* retval;
+
+#ifdef MCHEAP_THREAD_CACHE
+	retval = cache_allocate(heap, size);
+#else
+	LOCK(heap);
+	#ifdef MCHEAP_SLAB
+	retval = slab_allocate(heap, size);
+	if(!retval)
+		retval = region_allocate(heap, size);
+	#else
+	retval = region_allocate(heap, size);
+	#endif
+	UNLOCK(heap);
+#endif
+
+#ifdef MCHEAP_AUTO_DEFRAG
+	// a bounded step, which stops once the merged free space is large enough, and if anything was moved it may now fit
+	if(!retval && size && defrag_step(heap, MCHEAP_AUTO_DEFRAG_BUDGET, size))
+	{
+		LOCK(heap);
+		retval = region_allocate(heap, size);
+		UNLOCK(heap);
+	};
+#endif
+
+	return retval;
+}
+
+void* mcheap_heap_reallocate(mcheap_t *heap, void* section, size_t new_size)
+{
+	return mcheap_heap_reallocate_ex(heap, section, new_size, new_size);
+}
+
+void* mcheap_heap_reallocate_ex(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size)
+{
+	void* retval;
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab;
+#endif
+
+	preserve_size = SMALLEST_OF(preserve_size, new_size);
+
+#ifdef MCHEAP_THREAD_CACHE
+	retval = cache_reallocate(heap, section, new_size, preserve_size);
+#else
+	LOCK(heap);
+	#ifdef MCHEAP_SLAB
+	slab = slab_of(heap, section);
+	if(section == NULL)
+	{
+		retval = slab_allocate(heap, new_size);
+		if(!retval)
+			retval = region_allocate(heap, new_size);
+	}
+	else if(slab)
+		retval = slab_reallocate(heap, slab, section, new_size, preserve_size);
+	else
+		retval = region_reallocate(heap, section, new_size, preserve_size);
+	#else
+	retval = region_reallocate(heap, section, new_size, preserve_size);
+	#endif
+	UNLOCK(heap);
+#endif
+
+	return retval;
+}
+
+void* mcheap_heap_free(mcheap_t *heap, void* section)
+{
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab;
+#endif
+
+#ifdef MCHEAP_THREAD_CACHE
+	cache_free(heap, section, 0);
+#else
+	LOCK(heap);
+	#ifdef MCHEAP_SLAB
+	slab = slab_of(heap, section);
+	if(slab)
+		slab_free(heap, slab, section);
+	else
+		region_free(heap, section);
+	#else
+	region_free(heap, section);
+	#endif
+	UNLOCK(heap);
+#endif
+
+	return NULL;
+}
+
+bool mcheap_heap_try_resize(mcheap_t *heap, void* section, size_t new_size)
+{
+	bool retval = false;
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab;
+#endif
+
+	if(section && new_size)
+	{
+		LOCK(heap);
+	#ifdef MCHEAP_SLAB
+		slab = slab_of(heap, section);
+		if(slab)
+			retval = (new_size <= slab->object_size);	// objects can't be resized, but any size up to the size class fits
+		else
+			retval = region_resize(heap, section, new_size);
+	#else
+		retval = region_resize(heap, section, new_size);
+	#endif
+		UNLOCK(heap);
+	};
+
+	return retval;
+}
+
+size_t mcheap_heap_usable_size(mcheap_t *heap, void* section)
+{
+	size_t retval = 0;
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab;
+#endif
+
+	if(section)
+	{
+	#ifdef MCHEAP_SLAB
+		LOCK(heap);
+		slab = slab_of(heap, section);
+		retval = slab ? slab->object_size : CONTENT_SIZE(container_of(section, struct used_struct, content));
+		UNLOCK(heap);
+	#else
+		(void)heap;
+		retval = CONTENT_SIZE(container_of(section, struct used_struct, content));
+	#endif
+	};
+
+	return retval;
+}
+
+void* mcheap_heap_reallocate_sized(mcheap_t *heap, void* section, size_t size, size_t new_size)
+{
+	void* retval;
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab = NULL;
+#endif
+
+#ifdef MCHEAP_THREAD_CACHE
+	assert(size_fits(heap, section, size));
+	if(section && new_size == 0)
+	{
+		cache_free(heap, section, enforce_minimum_allocation_size(size));
+		retval = NULL;
+	}
+	else
+		retval = cache_reallocate(heap, section, new_size, new_size);
+#else
+	LOCK(heap);
+	assert(size_fits(heap, section, size));
+	#ifdef MCHEAP_SLAB
+	if(size <= MCHEAP_SLAB_MAX)	// larger allocations are never made from a slab
+		slab = slab_of(heap, section);
+	if(section == NULL)
+	{
+		retval = slab_allocate(heap, new_size);
+		if(!retval)
+			retval = region_allocate(heap, new_size);
+	}
+	else if(slab)
+		retval = slab_reallocate(heap, slab, section, new_size, new_size);
+	else
+		retval = region_reallocate(heap, section, new_size, new_size);
+	#else
+	retval = region_reallocate(heap, section, new_size, new_size);
+	#endif
+	UNLOCK(heap);
+#endif
+
+	return retval;
+}
+
+void* mcheap_heap_free_sized(mcheap_t *heap, void* section, size_t size)
+{
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab = NULL;
+#endif
+
+#ifdef MCHEAP_THREAD_CACHE
+	assert(size_fits(heap, section, size));
+	cache_free(heap, section, enforce_minimum_allocation_size(size));
+#else
+	LOCK(heap);
+	assert(size_fits(heap, section, size));
+	#ifdef MCHEAP_SLAB
+	if(size <= MCHEAP_SLAB_MAX)	// larger allocations are never made from a slab
+		slab = slab_of(heap, section);
+	if(slab)
+		slab_free(heap, slab, section);
+	else
+		region_free(heap, section);
+	#else
+	region_free(heap, section);
+	#endif
+	UNLOCK(heap);
+#endif
+
+	return NULL;
+}
+
+bool mcheap_heap_allocate_batch(mcheap_t *heap, const size_t *sizes, void** ptrs, size_t count)
+{
+	bool retval;
+
+#ifdef MCHEAP_THREAD_CACHE
+	cache_prepare(heap);
+#endif
+	LOCK(heap);
+	retval = region_allocate_batch(heap, sizes, ptrs, count);
+#ifdef MCHEAP_THREAD_CACHE
+	if(!retval)
+	{
+		cache_flush(&thread_cache);
+		retval = region_allocate_batch(heap, sizes, ptrs, count);
+	};
+#endif
+	UNLOCK(heap);
+
+	return retval;
+}
+
+void mcheap_heap_free_batch(mcheap_t *heap, void** ptrs, size_t count)
+{
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab;
+	size_t i;
+#endif
+
+	LOCK(heap);
+#ifdef MCHEAP_SLAB
+	for(i = 0; i != count; i++)
+	{
+		slab = slab_of(heap, ptrs[i]);
+		if(slab)
+		{
+			slab_free(heap, slab, ptrs[i]);
+			ptrs[i] = NULL;
+		};
+	};
+#endif
+	region_free_batch(heap, ptrs, count);
+	UNLOCK(heap);
+}
+
+void* mcheap_heap_allocate_zeroed(mcheap_t *heap, size_t size)
+{
+	void* retval;
+
+#ifdef MCHEAP_THREAD_CACHE
+	cache_prepare(heap);
+#endif
+	LOCK(heap);
+	retval = region_allocate_zeroed(heap, size);
+#ifdef MCHEAP_THREAD_CACHE
+	if(!retval)
+	{
+		cache_flush(&thread_cache);
+		retval = region_allocate_zeroed(heap, size);
+	};
+#endif
+	UNLOCK(heap);
+
+	return retval;
+}
+
+void* mcheap_heap_allocate_aligned(mcheap_t *heap, size_t size, size_t align)
+{
+	void* retval = NULL;
+
+	if(align && MCHEAP_ALIGNMENT % align == 0)
+		retval = mcheap_heap_allocate(heap, size);
+	else if(!(align & (align - 1)) && align % MCHEAP_ALIGNMENT == 0)
+	{
+	#ifdef MCHEAP_THREAD_CACHE
+		cache_prepare(heap);
+	#endif
+		LOCK(heap);
+		retval = region_allocate_aligned(heap, size, align);
+	#ifdef MCHEAP_THREAD_CACHE
+		if(!retval)
+		{
+			cache_flush(&thread_cache);
+			retval = region_allocate_aligned(heap, size, align);
+		};
+	#endif
+		UNLOCK(heap);
+	};
+
+	return retval;
+}
+
+void* mcheap_heap_reallocate_aligned(mcheap_t *heap, void* section, size_t new_size, size_t align)
+{
+	void* retval = NULL;
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab;
+#endif
+
+	if(section == NULL)
+		retval = mcheap_heap_allocate_aligned(heap, new_size, align);
+	else if(new_size == 0)
+		retval = mcheap_heap_free(heap, section);
+	else if(align && MCHEAP_ALIGNMENT % align == 0)
+		retval = mcheap_heap_reallocate(heap, section, new_size);
+	else if(!(align & (align - 1)) && align % MCHEAP_ALIGNMENT == 0)
+	{
+	#ifdef MCHEAP_THREAD_CACHE
+		cache_prepare(heap);
+	#endif
+		LOCK(heap);
+	#ifdef MCHEAP_SLAB
+		slab = slab_of(heap, section);
+		if(slab)
+		{
+			// an object of a slab can't be resized in place, so it is always moved out of the slab
+			retval = region_allocate_aligned(heap, new_size, align);
+			if(retval)
+			{
+				memcpy(retval, section, SMALLEST_OF(new_size, slab->object_size));
+				slab_free(heap, slab, section);
+			};
+		}
+		else
+			retval = region_reallocate_aligned(heap, section, new_size, align);
+	#else
+		retval = region_reallocate_aligned(heap, section, new_size, align);
+	#endif
+		UNLOCK(heap);
+	};
+
+	return retval;
+}
+
+mcheap_handle_t mcheap_heap_handle_allocate(mcheap_t *heap, size_t size)
+{
+	struct mcheap_handle_struct *retval = NULL;
+#ifdef MCHEAP_HANDLES
+	struct mcheap_handle_struct *handle;
+
+	#ifdef MCHEAP_THREAD_CACHE
+	cache_prepare(heap);
+	#endif
+	LOCK(heap);
+	handle = handle_unused(heap);
+	if(handle && size)
+	{
+		handle->section = region_allocate(heap, size);
+	#ifdef MCHEAP_THREAD_CACHE
+		if(!handle->section)
+		{
+			cache_flush(&thread_cache);
+			handle->section = region_allocate(heap, size);
+		};
+	#endif
+		if(handle->section)
+		{
+			handle_insert(heap, handle);
+			retval = handle;
+		};
+	};
+	UNLOCK(heap);
+#else
+	(void)heap;
+	(void)size;
+#endif
+
+	return retval;
+}
+
+void* mcheap_heap_handle_lock(mcheap_t *heap, mcheap_handle_t handle)
+{
+	void* retval = NULL;
+
+	(void)heap;		// only used by the lock
+#ifdef MCHEAP_HANDLES
+	if(handle)
+	{
+		LOCK(heap);
+		handle->lock_count++;
+		retval = handle->section;
+		UNLOCK(heap);
+	};
+#else
+	(void)handle;
+#endif
+
+	return retval;
+}
+
+void mcheap_heap_handle_unlock(mcheap_t *heap, mcheap_handle_t handle)
+{
+	(void)heap;		// only used by the lock
+#ifdef MCHEAP_HANDLES
+	if(handle)
+	{
+		LOCK(heap);
+		if(handle->lock_count)
+			handle->lock_count--;
+		UNLOCK(heap);
+	};
+#else
+	(void)handle;
+#endif
+}
+
+void mcheap_heap_handle_free(mcheap_t *heap, mcheap_handle_t handle)
+{
+#ifdef MCHEAP_HANDLES
+	if(handle)
+	{
+		LOCK(heap);
+		region_free(heap, handle->section);
+		handle_unlink(heap, handle);
+		memset(handle, 0, sizeof(*handle));
+		UNLOCK(heap);
+	};
+#else
+	(void)heap;
+	(void)handle;
+#endif
+}
+
+size_t mcheap_heap_compact(mcheap_t *heap, size_t budget)
+{
+	size_t retval = 0;
+#ifdef MCHEAP_HANDLES
+	void* cursor = NULL;
+
+	#ifdef MCHEAP_THREAD_CACHE
+	cache_prepare(heap);
+	#endif
+	LOCK(heap);
+	#ifdef MCHEAP_THREAD_CACHE
+	cache_flush(&thread_cache);		// cached allocations are used sections, which would be in the way
+	#endif
+	retval = handle_compact(heap, budget, 0, &cursor);
+	UNLOCK(heap);
+#else
+	(void)heap;
+	(void)budget;
+#endif
+
+	return retval;
+}
+
+mcheap_handle_t mcheap_heap_register(mcheap_t *heap, void* section, mcheap_move_hook_t hook, void* arg)
+{
+	struct mcheap_handle_struct *retval = NULL;
+#ifdef MCHEAP_HANDLES
+	bool movable;
+
+	LOCK(heap);
+	// only a section of a region can be moved, not a slab object or an allocation with it's own mapping
+	movable = section && hook && region_of(heap, section);
+	#ifdef MCHEAP_SLAB
+	movable = movable && !slab_of(heap, section);
+	#endif
+	if(movable)
+		retval = handle_unused(heap);
+	if(retval)
+	{
+		retval->section = section;
+		retval->hook = hook;
+		retval->arg = arg;
+		handle_insert(heap, retval);
+	};
+	UNLOCK(heap);
+#else
+	(void)heap;
+	(void)section;
+	(void)hook;
+	(void)arg;
+#endif
+
+	return retval;
+}
+
+void mcheap_heap_unregister(mcheap_t *heap, mcheap_handle_t handle)
+{
+	(void)heap;		// only used by the lock
+#ifdef MCHEAP_HANDLES
+	if(handle)
+	{
+		LOCK(heap);
+		handle_unlink(heap, handle);
+		memset(handle, 0, sizeof(*handle));
+		UNLOCK(heap);
+	};
+#else
+	(void)handle;
+#endif
+}
+
+size_t mcheap_heap_defrag_step(mcheap_t *heap, size_t max_bytes)
+{
+	size_t retval = 0;
+#ifdef MCHEAP_HANDLES
+	retval = defrag_step(heap, max_bytes, 0);
+#else
+	(void)heap;
+	(void)max_bytes;
+#endif
+
+	return retval;
+}
+
+size_t mcheap_heap_largest_free(mcheap_t *heap)
+{
+	mcheap_t *region;
+	size_t retval = 0;
+
+	LOCK(heap);
+	for(region = heap->first_region; region; region = region->next_region)
+		retval = LARGEST_OF(retval, free_find_largest(region));
+	UNLOCK(heap);
+
+	return retval;
+}
+
+size_t mcheap_heap_total_free(mcheap_t *heap)
+{
+	mcheap_t *region;
+	size_t retval = 0;
+
+	LOCK(heap);
+	for(region = heap->first_region; region; region = region->next_region)
+		retval += free_find_total(region);
+	UNLOCK(heap);
+
+	return retval;
+}
+
+bool mcheap_heap_set_placement(mcheap_t *heap, mcheap_placement_t new_placement)
+{
+#ifdef ENGINE_LIST
+	mcheap_t *region;
+	bool retval = true;
+
+	LOCK(heap);
+	switch(new_placement)
+	{
+		case MCHEAP_FIRST_FIT:
+		case MCHEAP_NEXT_FIT:
+		case MCHEAP_BEST_FIT:
+		case MCHEAP_WORST_FIT:
+			for(region = heap->first_region; region; region = region->next_region)
+			{
+				region->placement = new_placement;
+				region->rover = NULL;
+			};
+			break;
+		default:
+			retval = false;
+	};
+	UNLOCK(heap);
+
+	return retval;
+#else
+	// the other engines have their own fixed placement, which isn't any of the policies
+	(void)heap;
+	(void)new_placement;
+	return false;
+#endif
+}
+
+size_t mcheap_heap_set_copy_budget(mcheap_t *heap, size_t budget)
+{
+	mcheap_t *region;
+	size_t retval;
+
+	LOCK(heap);
+	retval = heap->copy_budget;
+	for(region = heap->first_region; region; region = region->next_region)
+		region->copy_budget = budget;
+	UNLOCK(heap);
+
+	return retval;
+}
+
+void mcheap_heap_set_lock_hooks(mcheap_t *heap, mcheap_lock_hook_t lock, mcheap_lock_hook_t unlock, void* arg)
+{
+#ifdef MCHEAP_THREAD_SAFE
+	heap->lock_hook = lock;
+	heap->unlock_hook = unlock;
+	heap->lock_arg = arg;
+#else
+	(void)heap;
+	(void)lock;
+	(void)unlock;
+	(void)arg;
+#endif
+}
+
+bool mcheap_heap_is_intact(mcheap_t *heap)
+{
+	mcheap_t *region;
+	bool retval = true;
+
+	LOCK(heap);
+	for(region = heap->first_region; region && retval; region = region->next_region)
+		retval = heap_test(region);
+	UNLOCK(heap);
+
+	return retval;
+}
+
+void mcheap_heap_reinit(mcheap_t *heap)
+{
+	mcheap_t *region;
+
+	LOCK(heap);
+	for(region = heap->first_region; region; region = region->next_region)
+		initialize(region);
+	UNLOCK(heap);
+}
+
+size_t mcheap_heap_trim(mcheap_t *heap)
+{
+	size_t retval = 0;
+#ifdef MCHEAP_TRIM
+	mcheap_t *region;
+
+	LOCK(heap);
+	for(region = heap->first_region; region; region = region->next_region)
+		retval += heap_trim(region);
+	UNLOCK(heap);
+#else
+	(void)heap;
+#endif
+	return retval;
+}
+
+bool mcheap_heap_add_region(mcheap_t *heap, void* buffer, size_t size, int priority)
+{
+	mcheap_t *region = heap_create(buffer, size, size, false, true);
+	mcheap_t **link_ptr;
+
+	if(region)
+	{
+		region->first_region = NULL;
+		region->priority = priority;
+		region->copy_budget = heap->copy_budget;
+	#ifdef ENGINE_LIST
+		region->placement = heap->placement;
+	#endif
+	#ifdef MCHEAP_THREAD_SAFE
+		region->owner = heap;
+	#endif
+
+		// insert after any regions of the same priority
+		LOCK(heap);
+		link_ptr = &heap->first_region;
+		while(*link_ptr && (*link_ptr)->priority >= priority)
+			link_ptr = &(*link_ptr)->next_region;
+		region->next_region = *link_ptr;
+		*link_ptr = region;
+		UNLOCK(heap);
+	};
+
+	return region != NULL;
+}
+
+void* mcheap_allocate(size_t size)
+{
+	return mcheap_heap_allocate(get_default_heap(), size);
+}
+
+void* mcheap_reallocate(void* section, size_t new_size)
+{
+	return mcheap_heap_reallocate(get_default_heap(), section, new_size);
+}
+
+void* mcheap_reallocate_ex(void* section, size_t new_size, size_t preserve_size)
+{
+	return mcheap_heap_reallocate_ex(get_default_heap(), section, new_size, preserve_size);
+}
+
+void* mcheap_free(void* section)
+{
+	return mcheap_heap_free(get_default_heap(), section);
+}
+
+bool mcheap_try_resize(void* section, size_t new_size)
+{
+	return mcheap_heap_try_resize(get_default_heap(), section, new_size);
+}
+
+size_t mcheap_usable_size(void* section)
+{
+	return mcheap_heap_usable_size(get_default_heap(), section);
+}
+
+void* mcheap_reallocate_sized(void* section, size_t size, size_t new_size)
+{
+	return mcheap_heap_reallocate_sized(get_default_heap(), section, size, new_size);
+}
+
+void* mcheap_free_sized(void* section, size_t size)
+{
+	return mcheap_heap_free_sized(get_default_heap(), section, size);
+}
+
+bool mcheap_allocate_batch(const size_t *sizes, void** ptrs, size_t count)
+{
+	return mcheap_heap_allocate_batch(get_default_heap(), sizes, ptrs, count);
+}
+
+void mcheap_free_batch(void** ptrs, size_t count)
+{
+	mcheap_heap_free_batch(get_default_heap(), ptrs, count);
+}
+
+void* mcheap_allocate_zeroed(size_t size)
+{
+	return mcheap_heap_allocate_zeroed(get_default_heap(), size);
+}
+
+void* mcheap_allocate_aligned(size_t size, size_t align)
+{
+	return mcheap_heap_allocate_aligned(get_default_heap(), size, align);
+}
+
+void* mcheap_reallocate_aligned(void* section, size_t new_size, size_t align)
+{
+	return mcheap_heap_reallocate_aligned(get_default_heap(), section, new_size, align);
+}
+
+mcheap_handle_t mcheap_handle_allocate(size_t size)
+{
+	return mcheap_heap_handle_allocate(get_default_heap(), size);
+}
+
+void* mcheap_handle_lock(mcheap_handle_t handle)
+{
+	return mcheap_heap_handle_lock(get_default_heap(), handle);
+}
+
+void mcheap_handle_unlock(mcheap_handle_t handle)
+{
+	mcheap_heap_handle_unlock(get_default_heap(), handle);
+}
+
+void mcheap_handle_free(mcheap_handle_t handle)
+{
+	mcheap_heap_handle_free(get_default_heap(), handle);
+}
+
+size_t mcheap_compact(size_t budget)
+{
+	return mcheap_heap_compact(get_default_heap(), budget);
+}
+
+mcheap_handle_t mcheap_register(void* section, mcheap_move_hook_t hook, void* arg)
+{
+	return mcheap_heap_register(get_default_heap(), section, hook, arg);
+}
+
+void mcheap_unregister(mcheap_handle_t handle)
+{
+	mcheap_heap_unregister(get_default_heap(), handle);
+}
+
+size_t mcheap_defrag_step(size_t max_bytes)
+{
+	return mcheap_heap_defrag_step(get_default_heap(), max_bytes);
+}
+
+void mcheap_flush_cache(void)
+{
+#ifdef MCHEAP_THREAD_CACHE
+	mcheap_t *heap = thread_cache.heap;
+
+	if(heap)
+	{
+		LOCK(heap);
+		cache_flush(&thread_cache);
+		UNLOCK(heap);
+	};
+#endif
+}
+
+size_t mcheap_largest_free(void)
+{
+	return mcheap_heap_largest_free(get_default_heap());
+}
+
+size_t mcheap_total_free(void)
+{
+	return mcheap_heap_total_free(get_default_heap());
+}
+
+bool mcheap_set_placement(mcheap_placement_t new_placement)
+{
+	return mcheap_heap_set_placement(get_default_heap(), new_placement);
+}
+
+size_t mcheap_set_copy_budget(size_t budget)
+{
+	return mcheap_heap_set_copy_budget(get_default_heap(), budget);
+}
+
+void mcheap_set_lock_hooks(mcheap_lock_hook_t lock, mcheap_lock_hook_t unlock, void* arg)
+{
+	mcheap_heap_set_lock_hooks(get_default_heap(), lock, unlock, arg);
+}
+
+bool mcheap_is_intact(void)
+{
+	return mcheap_heap_is_intact(get_default_heap());
+}
+
+void mcheap_reinit(void)
+{
+	mcheap_heap_reinit(get_default_heap());
+}
+
+size_t mcheap_trim(void)
+{
+	return mcheap_heap_trim(get_default_heap());
+}
+
+bool mcheap_add_region(void* buffer, size_t size, int priority)
+{
+	return mcheap_heap_add_region(get_default_heap(), buffer, size, priority);
+}
+
+//********************************************************************************************************
+// Private functions
+//********************************************************************************************************
+
+static mcheap_t* get_default_heap(void)
+{
+#if defined(MCHEAP_THREAD_SAFE) && !defined(MCHEAP_NO_PTHREAD)
+	pthread_once(&default_heap_once, default_heap_init);
+#else
+	if(!default_heap)
+		default_heap_init();
+#endif
+	return default_heap;
+}
+
+static void default_heap_init(void)
+{
+#if defined(MCHEAP_GROWABLE)
+	default_heap = mcheap_reserve(MCHEAP_SIZE);
+#elif defined(MCHEAP_ADDRESS)
+	default_heap = mcheap_init(heap_space, MCHEAP_SIZE);
+#else
+	default_heap = heap_create(heap_space, MCHEAP_SIZE, MCHEAP_SIZE, true, false);	// heap_space is zero filled until first used
+#endif
+}
+
+static mcheap_t* heap_create(void* buffer, size_t size, size_t reserve, bool zeroed, bool region)
+{
+	mcheap_t *heap = NULL;
+	size_t lead = -(uintptr_t)buffer % MCHEAP_ALIGNMENT;
+	size_t control;
+	uint8_t *tables;
+
+	if(lead < size)
+	{
+		size -= lead;
+		reserve -= lead;
+		control = control_size(reserve, region);
+		if(control < size && size - control >= sizeof(struct free_struct) && HEAP_SPAN(reserve, control) <= HEAP_SIZE_MAX)
+		{
+			heap = (void*)((uint8_t*)buffer + lead);
+			memset(heap, 0, sizeof(struct mcheap_struct));
+			heap->start = (uint8_t*)heap + control;
+			heap->end = heap->start + (size - control) / MCHEAP_ALIGNMENT * MCHEAP_ALIGNMENT;
+		#ifdef MCHEAP_GROWABLE
+			heap->limit = heap->start + (reserve - control) / MCHEAP_ALIGNMENT * MCHEAP_ALIGNMENT;
+		#endif
+			heap->first_region = heap;
+			heap->copy_budget = MCHEAP_COPY_BUDGET;
+			tables = (uint8_t*)&heap[1];
+
+		#ifdef MCHEAP_HANDLES
+			if(!region)
+			{
+				heap->handles = (void*)tables;
+				tables += MCHEAP_HANDLE_COUNT * sizeof(*heap->handles);
+			};
+		#endif
+
+		#ifdef ENGINE_LIST
+			heap->placement = MCHEAP_PLACEMENT;
+		#endif
+
+		#ifdef MCHEAP_ENGINE_SEGREGATED
+			heap->bins = (void*)tables;
+			heap->bin_count = floor_log2(reserve) + 1;
+			tables += heap->bin_count * sizeof(*heap->bins);
+		#endif
+
+		#ifdef MCHEAP_ENGINE_TLSF
+			heap->fl_count = FL_COUNT(reserve);
+			heap->tlsf_lists = (void*)tables;
+			tables += heap->fl_count * sizeof(*heap->tlsf_lists);
+			heap->sl_map = (void*)tables;
+			tables += heap->fl_count * sizeof(*heap->sl_map);
+		#endif
+
+		#ifdef MCHEAP_SLAB
+			heap->slab_map = (void*)tables;
+			tables += SLAB_CHUNK_COUNT(reserve) * sizeof(*heap->slab_map);
+		#endif
+
+		#ifdef MCHEAP_THREAD_SAFE
+			heap->owner = heap;
+			#ifndef MCHEAP_NO_PTHREAD
+			pthread_mutex_init(&heap->default_mutex, NULL);
+			#endif
+		#endif
+
+			(void)tables;
+			(void)region;
+			initialize(heap);
+
+			// initialize() only writes the meta data of the first section
+			if(zeroed)
+				FREECAST(heap->start)->size |= FLAG_ZERO;
+		};
+	};
+
+	return heap;
+}
+
+static size_t control_size(size_t size, bool region)
+{
+	size_t retval = sizeof(struct mcheap_struct);
+
+	(void)size;
+	(void)region;
+
+#ifdef MCHEAP_ENGINE_SEGREGATED
+	retval += (floor_log2(size) + 1) * sizeof(struct free_struct*);
+#endif
+
+#ifdef MCHEAP_ENGINE_TLSF
+	retval += FL_COUNT(size) * (SL_COUNT * sizeof(struct free_struct*) + sizeof(uint32_t));
+#endif
+
+#ifdef MCHEAP_SLAB
+	retval += SLAB_CHUNK_COUNT(size) * sizeof(struct slab_struct*);
+#endif
+
+#ifdef MCHEAP_HANDLES
+	if(!region)
+		retval += MCHEAP_HANDLE_COUNT * sizeof(struct mcheap_handle_struct);
+#endif
+
+	return align_size(retval);
+}
+
+static void initialize(mcheap_t *heap)
+{
+	struct free_struct *free_ptr;
+
+	free_ptr = (void*)heap->start;		//the whole heap is one free section
+	free_ptr->size = (heap->end - heap->start - sizeof(struct free_struct)) | FLAG_FREE;
+#ifdef BOUNDARY_TAGS
+	free_ptr->prev_size = 0;
+	heap->top_size = heap->end - heap->start;
+#endif
+
+#if defined(ENGINE_LIST)
+	heap->first_free = FREE_TO_LINK(heap, free_ptr);	//init head of the free list
+	free_ptr->next_ptr = FREE_TO_LINK(heap, NULL);
+	heap->rover = NULL;
+#elif defined(MCHEAP_ENGINE_SEGREGATED)
+	memset(heap->bins, 0, heap->bin_count * sizeof(*heap->bins));
+	heap->bin_map = 0;
+	free_insert(heap, free_ptr);
+#elif defined(MCHEAP_ENGINE_TLSF)
+	memset(heap->tlsf_lists, 0, heap->fl_count * sizeof(*heap->tlsf_lists));
+	memset(heap->sl_map, 0, heap->fl_count * sizeof(*heap->sl_map));
+	heap->fl_map = 0;
+	free_insert(heap, free_ptr);
+#elif defined(MCHEAP_ENGINE_TREE)
+	heap->tree_root = NULL;
+	free_insert(heap, free_ptr);
+#endif
+
+#ifdef MCHEAP_SLAB
+	memset(heap->slab_partial, 0, sizeof(heap->slab_partial));
+	memset(heap->slab_map, 0, SLAB_CHUNK_COUNT(heap->end - heap->start) * sizeof(*heap->slab_map));
+#endif
+
+#ifdef MCHEAP_HANDLES
+	if(heap->handles)
+		memset(heap->handles, 0, MCHEAP_HANDLE_COUNT * sizeof(*heap->handles));
+	heap->first_handle = NULL;
+	heap->defrag_cursor = NULL;
+#endif
+
+#ifdef MCHEAP_THREAD_CACHE
+	heap->generation = __atomic_add_fetch(&cache_generation, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+#ifdef MCHEAP_GROWABLE
+// Commit more reserved space to the top of the heap, enough to allocate size bytes, return false if it can't grow
+// At least MCHEAP_GROW_SIZE is committed at once. The new space is released as a free section, so it merges with the top section if that is free.
+static bool heap_grow(mcheap_t *heap, size_t size)
+{
+	struct free_struct *free_ptr;
+	uint8_t *new_end;
+	size_t grow;
+	bool retval = false;
+
+	if(heap->end != heap->limit && size < (size_t)(heap->limit - heap->start))
+	{
+		grow = page_align(LARGEST_OF(sizeof(struct free_struct) + sizeof(struct used_struct) + enforce_minimum_allocation_size(size), MCHEAP_GROW_SIZE));
+		new_end = (grow < (size_t)(heap->limit - heap->end)) ? heap->end + grow : heap->limit;
+		if((size_t)(new_end - heap->end) >= sizeof(struct free_struct) && mprotect(heap->end, new_end - heap->end, PROT_READ | PROT_WRITE) == 0)
+		{
+			free_ptr = (void*)heap->end;
+			free_ptr->size = (new_end - heap->end - sizeof(struct free_struct)) | FLAG_FREE | FLAG_ZERO;
+		#ifdef BOUNDARY_TAGS
+			free_ptr->prev_size = heap->top_size;
+		#endif
+			heap->end = new_end;
+			TAG_NEXT(heap, free_ptr);
+			free_release(heap, free_ptr);
+			retval = true;
+		};
+	};
+
+	return retval;
+}
+#endif
+
+// If zeroed is true the content is cleared, except for any part of it which is known to be zero already
+static void* allocate(mcheap_t *heap, size_t size, bool zeroed)
+{
+	struct free_struct *free_ptr;
+	struct used_struct *used_ptr;
+	size_t clear = size;
+	void* retval=NULL;
+#ifdef MCHEAP_TRACK_ZERO
+	void* section_end;
+	bool zero;
+#endif
+
+	size = enforce_minimum_allocation_size(size);
+
+	free_ptr = free_walk(heap, size);
+#ifdef MCHEAP_GROWABLE
+	if(!free_ptr && heap_grow(heap, size))
+		free_ptr = free_walk(heap, size);
+#endif
+	if(free_ptr)
+	{
+		free_remove(heap, free_ptr);				//remove from the free list
+	#ifdef MCHEAP_TRACK_ZERO
+		// only the part of the content which held the free section meta data is dirty, and any remainder split from the end stays zero
+		zero = !!(free_ptr->size & FLAG_ZERO);
+		section_end = SECTION_AFTER(free_ptr);
+		if(zero && clear > sizeof(struct free_struct) - sizeof(struct used_struct))
+			clear = sizeof(struct free_struct) - sizeof(struct used_struct);
+	#endif
+		used_ptr = free_to_used(free_ptr);	//convert to used section
+		used_shrink(heap, used_ptr, size);		//shrink to required size
+	#ifdef MCHEAP_TRACK_ZERO
+		if(zero && SECTION_AFTER(used_ptr) != section_end)
+			FREECAST(SECTION_AFTER(used_ptr))->size |= FLAG_ZERO;
+	#endif
+		retval = used_ptr->content;
+		if(zeroed)
+			memset(retval, 0, clear);
+	};
+
+	return retval;
+}
+
+// The free section found for size alone is taken if it has room for the padding it needs, such as one whose content is already aligned.
+// Otherwise find a free section with room for the content and the most padding any section could need, whatever it's address.
+static void* allocate_aligned(mcheap_t *heap, size_t size, size_t align)
+{
+	struct free_struct *free_ptr;
+	struct used_struct *used_ptr;
+	struct used_struct *new_used_ptr;
+	size_t padding;
+	size_t needed;
+	void* retval = NULL;
+
+	size = enforce_minimum_allocation_size(size);
+
+	if(size <= HEAP_SIZE_MAX - align - sizeof(struct free_struct))
+	{
+		// the content of the section as a used section starts where the used section meta data ends
+		free_ptr = free_walk(heap, size);
+		if(free_ptr && SECTION_SIZE(free_ptr) - sizeof(struct used_struct) < size + aligned_padding((uint8_t*)free_ptr + sizeof(struct used_struct), align))
+			free_ptr = NULL;
+
+		needed = size + align + sizeof(struct free_struct);
+		if(!free_ptr)
+			free_ptr = free_walk(heap, needed);
+	#ifdef MCHEAP_GROWABLE
+		if(!free_ptr && heap_grow(heap, needed))
+			free_ptr = free_walk(heap, needed);
+	#endif
+		if(free_ptr)
+		{
+			free_remove(heap, free_ptr);
+			used_ptr = free_to_used(free_ptr);
+			padding = aligned_padding(used_ptr->content, align);
+
+			if(padding)
+			{
+				// the used section starts padding bytes higher, and the space below it is released
+				new_used_ptr = (void*)((uint8_t*)used_ptr + padding);
+				new_used_ptr->size = CONTENT_SIZE(used_ptr) - padding;
+			#ifdef BOUNDARY_TAGS
+				new_used_ptr->prev_size = padding;
+			#endif
+				TAG_NEXT(heap, new_used_ptr);
+				free_ptr = (void*)used_ptr;
+				free_ptr->size = (padding - sizeof(struct free_struct)) | FLAG_FREE;
+				free_release(heap, free_ptr);
+				used_ptr = new_used_ptr;
+			};
+
+			used_shrink(heap, used_ptr, size);
+			retval = used_ptr->content;
+		};
+	};
+
+	return retval;
+}
+
+// The padding before the content becomes a free section of it's own, so it is only ever less than align if no padding is needed.
+// Otherwise it is increased by align until it can hold a free section.
+static size_t aligned_padding(void* content, size_t align)
+{
+	size_t padding = -(uintptr_t)content % align;
+
+	while(padding && padding < sizeof(struct free_struct))
+		padding += align;
+
+	return padding;
+}
+
+// The batch is allocated as one used section, which is then divided into a used section for each allocation
+// The last allocation takes any remainder too small to be split off as a free section.
+static bool allocate_batch(mcheap_t *heap, const size_t *sizes, void** sections, size_t count)
+{
+	struct free_struct *free_ptr = NULL;
+	struct used_struct *used_ptr;
+	struct used_struct *next_ptr;
+	size_t total = 0;
+	size_t size;
+	size_t i;
+	bool retval = false;
+
+	for(i = 0; i != count && total <= HEAP_SIZE_MAX / 2; i++)
+		total += sizeof(struct used_struct) + enforce_minimum_allocation_size(SMALLEST_OF(sizes[i], HEAP_SIZE_MAX / 2));
+
+	if(count && total <= HEAP_SIZE_MAX / 2)
+	{
+		total -= sizeof(struct used_struct);
+		free_ptr = free_walk(heap, total);
+	#ifdef MCHEAP_GROWABLE
+		if(!free_ptr && heap_grow(heap, total))
+			free_ptr = free_walk(heap, total);
+	#endif
+	};
+
+	if(free_ptr)
+	{
+		free_remove(heap, free_ptr);
+		used_ptr = free_to_used(free_ptr);
+		used_shrink(heap, used_ptr, total);
+
+		for(i = 0; i != count - 1; i++)
+		{
+			size = enforce_minimum_allocation_size(sizes[i]);
+			next_ptr = (void*)&used_ptr->content[size];
+			next_ptr->size = CONTENT_SIZE(used_ptr) - size - sizeof(struct used_struct);
+			used_ptr->size = size;
+			TAG_NEXT(heap, used_ptr);
+			sections[i] = used_ptr->content;
+			used_ptr = next_ptr;
+		};
+		TAG_NEXT(heap, used_ptr);
+		sections[i] = used_ptr->content;
+		retval = true;
+	};
+
+	return retval;
+}
+
+static void* reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size)
+{
+	struct free_struct* free_ptr;
+	struct free_struct* relocation_ptr;
+	struct used_struct* used_ptr;
+	struct used_struct* new_used_ptr = NULL;
+	size_t copy_size;
+	bool in_place;
+	void* retval = NULL;
+
+	if(section == NULL)
+		retval = allocate(heap, new_size, false);					//if section == NULL just call allocate()
+	else if(new_size == 0)
+		retval = internal_free(heap, section);
+	else
+	{
+		new_size = enforce_minimum_allocation_size(new_size);
+		used_ptr = container_of(section, struct used_struct, content);
+
+		// find space for new allocation
+		relocation_ptr = free_walk(heap, new_size);
+
+		// a section which can be resized in place is only moved down if it is worth the copy, see worth_moving()
+		copy_size = SMALLEST_OF(preserve_size, CONTENT_SIZE(used_ptr));
+		in_place = new_size <= CONTENT_SIZE(used_ptr) || used_section_can_extend_up(heap, used_ptr, new_size);
+
+		// relocate to a lower address? (1st preference to minimize fragmentation)
+		if(relocation_ptr && (void*)relocation_ptr < (void*)used_ptr
+			&& (!in_place || worth_moving(heap, copy_size, (uint8_t*)used_ptr - (uint8_t*)relocation_ptr)))
+			new_used_ptr = relocate(heap, relocation_ptr, used_ptr, preserve_size);
+
+		else
+		{
+			free_ptr = find_free_below(heap, used_ptr); 
+			if(used_section_can_extend_down(free_ptr, used_ptr, new_size)
+				&& (!in_place || worth_moving(heap, copy_size, SECTION_SIZE(free_ptr)))) // 2nd preference
+			{
+				free_remove(heap, free_ptr);
+				new_used_ptr = used_extend_down(heap, free_ptr, used_ptr, preserve_size);
+			}
+			else if(new_size <= CONTENT_SIZE(used_ptr))	//shrink in place? 3rd preference
+				new_used_ptr = used_ptr;
+			else if(used_section_can_extend_up(heap, used_ptr, new_size))	//4th preference
+			{
+				free_remove(heap, SECTION_AFTER(used_ptr));
+				new_used_ptr = used_extend_up(heap, used_ptr);
+			}
+			else if(used_section_can_extend_both(heap, free_ptr, used_ptr, new_size))	//5th preference
+			{
+				preserve_size = SMALLEST_OF(preserve_size, CONTENT_SIZE(used_ptr));	// don't move the content of the section above
+				free_remove(heap, SECTION_AFTER(used_ptr));
+				used_extend_up(heap, used_ptr);
+				free_remove(heap, free_ptr);
+				new_used_ptr = used_extend_down(heap, free_ptr, used_ptr, preserve_size);
+			}
+			else if(relocation_ptr)
+				new_used_ptr = relocate(heap, relocation_ptr, used_ptr, preserve_size);	// 6th preference, relocate to higher address
+		};
+
+		// Shrink the new used section if possible
+		if(new_used_ptr)
+		{
+			used_shrink(heap, new_used_ptr, new_size);
+			retval = new_used_ptr->content;
+		};
+	};
+	return retval;
+}
+
+// Shrink the section, or extend it into the free section above it, without moving the content
+static void* resize_in_place(mcheap_t *heap, void* section, size_t new_size)
+{
+	struct used_struct *used_ptr = container_of(section, struct used_struct, content);
+	void* retval = NULL;
+
+	new_size = enforce_minimum_allocation_size(new_size);
+
+	if(new_size <= CONTENT_SIZE(used_ptr))
+		retval = section;
+	else if(used_section_can_extend_up(heap, used_ptr, new_size))
+	{
+		free_remove(heap, SECTION_AFTER(used_ptr));
+		used_extend_up(heap, used_ptr);
+		retval = section;
+	};
+
+	if(retval)
+		used_shrink(heap, used_ptr, new_size);
+
+	return retval;
+}
+
+// relocate of realloc
+// dest_ptr must be a suitable free section capable of allocating new_size bytes.
+// removes dest_ptr from the free list, moves src_ptr to dest_ptr, and adds src_ptr to the free list
+// preserves at most preserve_size bytes, which must not be more than the new size
+// returns the new used section at dest_ptr, does not shrink the destination.
+static struct used_struct* relocate(mcheap_t *heap, struct free_struct* dest_ptr, struct used_struct* src_ptr, size_t preserve_size)
+{
+	struct used_struct* new_used_ptr;
+	struct free_struct* new_free_ptr;
+	free_remove(heap, dest_ptr);
+	new_used_ptr = free_to_used(dest_ptr);
+
+	// both sections are now used, so other threads may use the heap during the copy
+	UNLOCK(heap);
+	memcpy(new_used_ptr->content, src_ptr->content, SMALLEST_OF(preserve_size, CONTENT_SIZE(src_ptr)));
+	LOCK(heap);
+
+	new_free_ptr = used_to_free(src_ptr);
+	free_release(heap, new_free_ptr);	// return it to the free list
+	return new_used_ptr;
+}
+
+static void* internal_free(mcheap_t *heap, void* section)
+{
+	struct used_struct *used_ptr;
+	struct free_struct *free_ptr;
+
+	if(section != NULL)
+	{
+		used_ptr = container_of(section, struct used_struct, content);
+			
+		free_ptr = used_to_free(used_ptr);	//convert to free section
+		free_release(heap, free_ptr);				//return to the free list
+	};
+	return NULL;
+}
+
+// Each run of adjacent sections is merged into one free section, before the runs are released together
+static void free_batch(mcheap_t *heap, void** sections, size_t count)
+{
+	struct free_struct *free_ptr;
+	struct free_struct *run_ptr = NULL;
+	size_t runs = 0;
+	size_t i;
+
+	for(i = 0; i != count; i++)
+	{
+		free_ptr = used_to_free(container_of(sections[i], struct used_struct, content));
+		if(run_ptr && SECTION_AFTER(run_ptr) == (void*)free_ptr)
+		{
+			run_ptr->size += SECTION_SIZE(free_ptr);
+			TAG_NEXT(heap, run_ptr);
+		}
+		else
+		{
+			run_ptr = free_ptr;
+			sections[runs++] = run_ptr;
+		};
+	};
+
+	free_release_sorted(heap, sections, runs);
+}
+
+// Shrink used section so that it's content is reduced to the new_size.
+// This will only happen if doing so allows a new free section to be created.
+// new_size should be pre-aligned by the caller
+// If created, the new free section will be inserted into the free list, and merged if possible
+static void used_shrink(mcheap_t *heap, struct used_struct *used_ptr, size_t new_size)
+{
+	struct free_struct *free_ptr;
+
+	if(new_size < CONTENT_SIZE(used_ptr))
+	{
+		// If this section is large enough for used meta + new_size + free meta
+		if(SECTION_SIZE(used_ptr) >= sizeof(struct used_struct) + new_size + sizeof(struct free_struct))
+		{
+			//remaining free section will start at the end of the shrunken used section
+			free_ptr = (void*)&(used_ptr->content[new_size]);
+
+			//construct remaining free section
+			free_ptr->size = (CONTENT_SIZE(used_ptr) - new_size - sizeof(struct free_struct)) | FLAG_FREE;
+
+			//shrink used section
+			used_ptr->size -= CONTENT_SIZE(used_ptr) - new_size;
+			TAG_NEXT(heap, used_ptr);
+			TAG_NEXT(heap, free_ptr);
+
+			free_insert(heap, free_ptr);
+			free_merge_up(heap, free_ptr);
+		};
+	};
+}
+
+// Convert a used section to a free section, does not insert into the free list
+// Returns the result
+static struct free_struct* used_to_free(struct used_struct *used_ptr)
+{
+	struct free_struct *free_ptr;
+
+//	Build new free section
+	free_ptr = (void*)used_ptr;
+	free_ptr->size = (SECTION_SIZE(used_ptr) - sizeof(struct free_struct)) | FLAG_FREE;
+
+	return free_ptr;
+}
+
+// Convert a free section into a used section, free section must be removed from the free list beforehand
+// Returns the result
+static struct used_struct* free_to_used(struct free_struct *free_ptr)
+{
+	struct used_struct *used_ptr;
+
+//	Build new used section
+	used_ptr = (void*)free_ptr;
+	used_ptr->size = SECTION_SIZE(free_ptr) - sizeof(struct used_struct);
+	return used_ptr;
+}
+
+// Return true, if moving a section down by distance bytes is worth copying copy_size bytes of it's content
+// The distance is the free space which the move closes up below the section, and which is merged with the free space above it instead.
+// The copy must be within the copy budget, and at most MCHEAP_COPY_RATIO times the distance.
+static bool worth_moving(mcheap_t *heap, size_t copy_size, size_t distance)
+{
+	return copy_size <= heap->copy_budget && copy_size / MCHEAP_COPY_RATIO <= distance;
+}
+
+// Return true, if the used section can extend down into the free section to acheive the desired size
+static bool used_section_can_extend_down(struct free_struct* free_ptr, struct used_struct* used_ptr, size_t desired_size)
+{
+	return (free_ptr
+		&& (SECTION_AFTER(free_ptr) == used_ptr)
+		&& (CONTENT_SIZE(used_ptr) + SECTION_SIZE(free_ptr) >= desired_size));
+}
+
+// Return true, if the used section can extend up into a free section to acheive the desired size
+static bool used_section_can_extend_up(mcheap_t *heap, struct used_struct* used_ptr, size_t desired_size)
+{
+	struct free_struct* free_ptr = SECTION_AFTER(used_ptr);
+
+	return ((void*)free_ptr != END_OF_HEAP(heap)
+		&& in_free_list(heap, free_ptr)
+		&& (CONTENT_SIZE(used_ptr) + SECTION_SIZE(free_ptr) >= desired_size) );
+}
+
+// Return true, if the used section can extend both down into the free section, and up into a free section, to acheive the desired size
+static bool used_section_can_extend_both(mcheap_t *heap, struct free_struct* free_ptr, struct used_struct* used_ptr, size_t desired_size)
+{
+	struct free_struct* next_ptr = SECTION_AFTER(used_ptr);
+
+	return (free_ptr
+		&& (SECTION_AFTER(free_ptr) == used_ptr)
+		&& (void*)next_ptr != END_OF_HEAP(heap)
+		&& in_free_list(heap, next_ptr)
+		&& (CONTENT_SIZE(used_ptr) + SECTION_SIZE(free_ptr) + SECTION_SIZE(next_ptr) >= desired_size) );
+}
+
+// Extend a used section into a lower free section, also moves content limited to 'preserve_size' bytes
+// Free section must be removed from the free list before calling this function
+// Returns the resulting used section
+static struct used_struct* used_extend_down(mcheap_t *heap, struct free_struct *free_ptr, struct used_struct *used_ptr, size_t preserve_size)
+{
+	size_t extra_size;
+	size_t move_size;
+#ifdef BOUNDARY_TAGS
+	size_t prev_size = free_ptr->prev_size;
+#endif
+
+//	extra size
+	extra_size = SECTION_SIZE(free_ptr);
+
+	if( preserve_size + sizeof(struct used_struct) < SECTION_SIZE(used_ptr) )
+		move_size = preserve_size + sizeof(struct used_struct);
+	else
+		move_size = SECTION_SIZE(used_ptr);
+
+//	move used section down, including limited content
+	memmove(free_ptr, used_ptr, move_size);
+	used_ptr = (void*)free_ptr;
+
+//	extend used section
+	used_ptr->size += extra_size;
+#ifdef BOUNDARY_TAGS
+	used_ptr->prev_size = prev_size;
+#endif
+	TAG_NEXT(heap, used_ptr);
+
+	return used_ptr;
+}
+
+// Extend a used section into a higher free section
+// The higher free section must be removed from the free list before calling this function
+static struct used_struct* used_extend_up(mcheap_t *heap, struct used_struct *used_ptr)
+{
+	struct free_struct *free_ptr;
+	size_t ext_size;
+
+	free_ptr = SECTION_AFTER(used_ptr);
+	ext_size = SECTION_SIZE(free_ptr);
+
+	used_ptr->size += ext_size;
+	TAG_NEXT(heap, used_ptr);
+
+	return used_ptr;
+}
+
+//********************************************************************************************************
+// Regions
+//********************************************************************************************************
+
+// Allocate from the region with the highest priority which has space, or give the allocation it's own mapping if it is large enough
+static void* region_allocate(mcheap_t *heap, size_t size)
+{
+	mcheap_t *region;
+	void* retval = NULL;
+
+#ifdef MCHEAP_MMAP_THRESHOLD
+	if(size >= MCHEAP_MMAP_THRESHOLD)
+		retval = map_allocate(size);
+	else
+#endif
+	for(region = heap->first_region; region && !retval; region = region->next_region)
+		retval = allocate(region, size, false);
+
+	return retval;
+}
+
+// Reallocate within the region holding the section, or if that fails, move it to any region with space
+// A section which grows to MCHEAP_MMAP_THRESHOLD is moved to it's own mapping
+static void* region_reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size)
+{
+	mcheap_t *region;
+	void* retval = NULL;
+
+	if(section == NULL)
+		retval = region_allocate(heap, new_size);
+#ifdef MCHEAP_MMAP_THRESHOLD
+	else if(is_mapped(section))
+		retval = map_reallocate(heap, section, new_size, preserve_size);
+	else if(new_size >= MCHEAP_MMAP_THRESHOLD)
+		retval = region_move(heap, section, new_size, preserve_size, MCHEAP_ALIGNMENT);
+#endif
+	else
+	{
+		region = region_of(heap, section);
+		if(region)
+			retval = reallocate(region, section, new_size, preserve_size);
+	#ifdef MCHEAP_GROWABLE
+		if(region && new_size && !retval && heap_grow(region, new_size))
+			retval = reallocate(region, section, new_size, preserve_size);
+	#endif
+
+		if(region && new_size && !retval && heap->first_region->next_region)
+			retval = region_move(heap, section, new_size, preserve_size, MCHEAP_ALIGNMENT);
+	};
+
+	return retval;
+}
+
+// Free a section in the region which holds it
+static void region_free(mcheap_t *heap, void* section)
+{
+	mcheap_t *region = region_of(heap, section);
+
+	if(region)
+		internal_free(region, section);
+#ifdef MCHEAP_MMAP_THRESHOLD
+	else if(section && is_mapped(section))
+		map_free(section);
+#endif
+}
+
+// Resize a section in the region which holds it, or it's own mapping, without moving it
+static bool region_resize(mcheap_t *heap, void* section, size_t new_size)
+{
+	mcheap_t *region = region_of(heap, section);
+	void* retval = NULL;
+
+	if(region)
+		retval = resize_in_place(region, section, new_size);
+#ifdef MCHEAP_MMAP_THRESHOLD
+	else if(section && is_mapped(section))
+		retval = map_resize(section, new_size);
+#endif
+
+	return retval != NULL;
+}
+
+// Carve a batch from one free section, in the region with the highest priority which has a section large enough
+// If no section can hold the whole batch, each allocation is made separately. On failure nothing is allocated.
+// A batch holding an allocation of at least MCHEAP_MMAP_THRESHOLD is always allocated separately, so that it gets it's own mapping.
+static bool region_allocate_batch(mcheap_t *heap, const size_t *sizes, void** sections, size_t count)
+{
+	mcheap_t *region = heap->first_region;
+	bool retval = false;
+	size_t i = 0;
+
+#ifdef MCHEAP_MMAP_THRESHOLD
+	while(i != count && sizes[i] < MCHEAP_MMAP_THRESHOLD)
+		i++;
+	if(i != count)
+		region = NULL;
+#endif
+
+	for(; region && !retval; region = region->next_region)
+		retval = allocate_batch(region, sizes, sections, count);
+
+	if(!retval)
+	{
+		for(i = 0; i != count && (sections[i] = region_allocate(heap, sizes[i])); i++)
+			;
+		retval = (i == count);
+		while(!retval && i)
+			region_free(heap, sections[--i]);
+	};
+
+	if(!retval)
+		memset(sections, 0, count * sizeof(void*));
+
+	return retval;
+}
+
+// Free a batch of sections, which are sorted by address so that the sections of each region are freed together
+static void region_free_batch(mcheap_t *heap, void** sections, size_t count)
+{
+	mcheap_t *region;
+	size_t first;
+	size_t i = 0;
+
+	qsort(sections, count, sizeof(void*), address_compare);
+
+	while(i != count)
+	{
+		first = i;
+		region = region_of(heap, sections[i]);
+		if(region)
+		{
+			while(i != count && (uint8_t*)sections[i] < region->end)
+				i++;
+			free_batch(region, &sections[first], i - first);
+		}
+		else
+		{
+		#ifdef MCHEAP_MMAP_THRESHOLD
+			if(sections[i] && is_mapped(sections[i]))
+				map_free(sections[i]);
+		#endif
+			i++;
+		};
+	};
+}
+
+// Allocate from the region with the highest priority which has space, and clear the content
+// An allocation given it's own mapping is zero filled already
+static void* region_allocate_zeroed(mcheap_t *heap, size_t size)
+{
+	mcheap_t *region;
+	void* retval = NULL;
+
+#ifdef MCHEAP_MMAP_THRESHOLD
+	if(size >= MCHEAP_MMAP_THRESHOLD)
+		retval = map_allocate(size);
+	else
+#endif
+	for(region = heap->first_region; region && !retval; region = region->next_region)
+		retval = allocate(region, size, true);
+
+	return retval;
+}
+
+// Allocate from the region with the highest priority which has space for the aligned allocation
+// Aligned allocations are never given their own mapping, as the content of a mapping is only aligned to MCHEAP_ALIGNMENT.
+static void* region_allocate_aligned(mcheap_t *heap, size_t size, size_t align)
+{
+	mcheap_t *region;
+	void* retval = NULL;
+
+	for(region = heap->first_region; region && !retval; region = region->next_region)
+		retval = allocate_aligned(region, size, align);
+
+	return retval;
+}
+
+// Resize the section in place if it is already aligned, otherwise move it to a new aligned allocation
+static void* region_reallocate_aligned(mcheap_t *heap, void* section, size_t new_size, size_t align)
+{
+	mcheap_t *region = region_of(heap, section);
+	void* retval = NULL;
+
+	if(region && (uintptr_t)section % align == 0)
+		retval = resize_in_place(region, section, new_size);
+
+	if(!retval)
+		retval = region_move(heap, section, new_size, new_size, align);
+
+	return retval;
+}
+
+// Move a section to a new allocation of new_size bytes aligned to align in any region, or it's own mapping, copying at most preserve_size bytes, return NULL on failure
+static void* region_move(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size, size_t align)
+{
+	struct used_struct *used_ptr = container_of(section, struct used_struct, content);
+	void* retval = (align > MCHEAP_ALIGNMENT) ? region_allocate_aligned(heap, new_size, align) : region_allocate(heap, new_size);
+
+	if(retval)
+	{
+		// both sections are now used, so other threads may use the heap during the copy
+		UNLOCK(heap);
+		memcpy(retval, section, SMALLEST_OF(preserve_size, CONTENT_SIZE(used_ptr)));
+		LOCK(heap);
+		region_free(heap, section);
+	};
+
+	return retval;
+}
+
+// Return the region of a heap which holds ptr, or NULL if ptr isn't in the heap
+static mcheap_t* region_of(mcheap_t *heap, void* ptr)
+{
+	mcheap_t *retval = heap->first_region;
+
+	while(retval && ((uint8_t*)ptr < retval->start || (uint8_t*)ptr >= retval->end))
+		retval = retval->next_region;
+
+	return retval;
+}
+
+//********************************************************************************************************
+// Direct mappings
+//********************************************************************************************************
+
+#ifdef MCHEAP_MMAP_THRESHOLD
+
+// Allocate a used section in it's own mapping, which is a whole number of pages
+static void* map_allocate(size_t size)
+{
+	struct used_struct *used_ptr;
+	size_t length;
+	void* retval = NULL;
+
+	if(size <= SIZE_MAX / 2)
+	{
+		length = page_align(sizeof(struct used_struct) + size);
+		used_ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(used_ptr != MAP_FAILED)
+		{
+			used_ptr->size = (length - sizeof(struct used_struct)) | FLAG_MAPPED;
+		#ifdef BOUNDARY_TAGS
+			used_ptr->prev_size = 0;
+		#endif
+			retval = used_ptr->content;
+		};
+	};
+
+	return retval;
+}
+
+// Reallocate an allocation with it's own mapping
+// A size below MCHEAP_MMAP_THRESHOLD is moved back into the heap if it fits.
+// Otherwise the mapping is resized with mremap(), which moves pages rather than copying the content.
+static void* map_reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size)
+{
+	struct used_struct *used_ptr = container_of(section, struct used_struct, content);
+	size_t length;
+	void* retval = NULL;
+
+	if(new_size == 0)
+		map_free(section);
+	else
+	{
+		if(new_size < MCHEAP_MMAP_THRESHOLD)
+			retval = region_move(heap, section, new_size, preserve_size, MCHEAP_ALIGNMENT);
+
+		if(!retval && new_size <= SIZE_MAX / 2)
+		{
+			length = page_align(sizeof(struct used_struct) + new_size);
+			used_ptr = mremap(used_ptr, SECTION_SIZE(used_ptr), length, MREMAP_MAYMOVE);
+			if(used_ptr != MAP_FAILED)
+			{
+				used_ptr->size = (length - sizeof(struct used_struct)) | FLAG_MAPPED;
+				retval = used_ptr->content;
+			};
+		};
+	};
+
+	return retval;
+}
+
+// Unmap an allocation with it's own mapping
+static void map_free(void* section)
+{
+	struct used_struct *used_ptr = container_of(section, struct used_struct, content);
+
+	munmap(used_ptr, SECTION_SIZE(used_ptr));
+}
+
+// The mapping is resized with mremap() without MREMAP_MAYMOVE, so growing fails if the pages after it are in use
+static void* map_resize(void* section, size_t new_size)
+{
+	struct used_struct *used_ptr = container_of(section, struct used_struct, content);
+	size_t length;
+	void* retval = NULL;
+
+	if(new_size <= SIZE_MAX / 2)
+	{
+		length = page_align(sizeof(struct used_struct) + new_size);
+		if(mremap(used_ptr, SECTION_SIZE(used_ptr), length, 0) != MAP_FAILED)
+		{
+			used_ptr->size = (length - sizeof(struct used_struct)) | FLAG_MAPPED;
+			retval = section;
+		};
+	};
+
+	return retval;
+}
+
+// Return true if an allocation has it's own mapping
+static bool is_mapped(void* section)
+{
+	return !!(USEDCAST(container_of(section, struct used_struct, content))->size & FLAG_MAPPED);
+}
+
+#endif
+
+//********************************************************************************************************
+// Handles
+//********************************************************************************************************
+
+#ifdef MCHEAP_HANDLES
+
+// The handles are searched linearly, MCHEAP_HANDLE_COUNT is expected to be small
+static struct mcheap_handle_struct* handle_unused(mcheap_t *heap)
+{
+	struct mcheap_handle_struct *retval = NULL;
+	int i = 0;
+
+	while(!retval && i != MCHEAP_HANDLE_COUNT)
+	{
+		if(!heap->handles[i].section)
+			retval = &heap->handles[i];
+		i++;
+	};
+
+	return retval;
+}
+
+// The used handles are walked from the lowest, this is only needed to find where compaction starts, it then follows the links
+static struct mcheap_handle_struct* handle_next(mcheap_t *heap, void* after)
+{
+	struct mcheap_handle_struct *retval = heap->first_handle;
+
+	while(retval && retval->section <= after)
+		retval = retval->next;
+
+	return retval;
+}
+
+static void handle_insert(mcheap_t *heap, struct mcheap_handle_struct *handle)
+{
+	struct mcheap_handle_struct **link_ptr = &heap->first_handle;
+
+	while(*link_ptr && (*link_ptr)->section < handle->section)
+		link_ptr = &(*link_ptr)->next;
+	handle->next = *link_ptr;
+	*link_ptr = handle;
+}
+
+static void handle_unlink(mcheap_t *heap, struct mcheap_handle_struct *handle)
+{
+	struct mcheap_handle_struct **link_ptr = &heap->first_handle;
+
+	while(*link_ptr && *link_ptr != handle)
+		link_ptr = &(*link_ptr)->next;
+	if(*link_ptr)
+		*link_ptr = handle->next;
+}
+
+// The allocation is relocated to a lower free section, or extended down into the free section before it, and then shrunk back to it's size.
+// Unlike relocate(), the lock is held during the copy, so that the handle can't be locked while it's content is moving.
+// An allocation with it's own mapping is never moved.
+// Only a relocated allocation may pass others, so only then is the handle linked again in order of address.
+static size_t handle_move(mcheap_t *heap, struct mcheap_handle_struct *handle)
+{
+	mcheap_t *region = region_of(heap, handle->section);
+	struct used_struct *used_ptr = container_of(handle->section, struct used_struct, content);
+	struct used_struct *new_used_ptr = NULL;
+	struct free_struct *free_ptr;
+	size_t size = CONTENT_SIZE(used_ptr);
+	bool relocated = false;
+
+	if(region)
+	{
+		free_ptr = free_walk(region, size);
+		if(free_ptr && (void*)free_ptr < (void*)used_ptr)
+		{
+			free_remove(region, free_ptr);
+			new_used_ptr = free_to_used(free_ptr);
+			memcpy(new_used_ptr->content, used_ptr->content, size);
+			free_release(region, used_to_free(used_ptr));
+			relocated = true;
+		}
+		else
+		{
+			free_ptr = find_free_below(region, used_ptr);
+			if(free_ptr && SECTION_AFTER(free_ptr) == used_ptr)
+			{
+				free_remove(region, free_ptr);
+				new_used_ptr = used_extend_down(region, free_ptr, used_ptr, size);
+			};
+		};
+	};
+
+	if(new_used_ptr)
+	{
+		used_shrink(region, new_used_ptr, size);
+		if(handle->hook)
+			handle->hook(handle->section, new_used_ptr->content, handle->arg);
+		handle->section = new_used_ptr->content;
+		if(relocated)
+		{
+			handle_unlink(heap, handle);
+			handle_insert(heap, handle);
+		};
+	}
+	else
+		size = 0;
+
+	return size;
+}
+
+// Allocations are visited in order of address, so each may move into the space left by the ones below it
+// *cursor is left at the address the last allocation visited had before it moved, or NULL once all have been visited
+static size_t handle_compact(mcheap_t *heap, size_t budget, size_t wanted, void** cursor)
+{
+	struct mcheap_handle_struct *handle = handle_next(heap, *cursor);
+	struct mcheap_handle_struct *next;
+	size_t retval = 0;
+	size_t size;
+	bool done = false;
+
+	while(handle && retval != budget && !done)
+	{
+		*cursor = handle->section;
+		next = handle->next;	// a relocated handle is linked again below the cursor
+		size = CONTENT_SIZE(container_of(handle->section, struct used_struct, content));
+		if(!handle->lock_count && size <= budget - retval && handle_move(heap, handle))
+		{
+			retval += size;
+			done = wanted && free_find_largest(region_of(heap, handle->section)) >= wanted;
+		};
+		handle = next;
+	};
+
+	if(!handle)
+		*cursor = NULL;
+
+	return retval;
+}
+
+// The thread cache is flushed first, as cached allocations are used sections which would be in the way
+static size_t defrag_step(mcheap_t *heap, size_t max_bytes, size_t wanted)
+{
+	size_t retval;
+
+	#ifdef MCHEAP_THREAD_CACHE
+	cache_prepare(heap);
+	#endif
+	LOCK(heap);
+	#ifdef MCHEAP_THREAD_CACHE
+	cache_flush(&thread_cache);
+	#endif
+	retval = handle_compact(heap, max_bytes, wanted, &heap->defrag_cursor);
+	UNLOCK(heap);
+
+	return retval;
+}
+
+#endif
+
+//********************************************************************************************************
+// Thread caches
+//********************************************************************************************************
+
+#ifdef MCHEAP_THREAD_CACHE
+
+// Allocate through the calling threads cache
+// An empty bin is refilled with a batch of allocations, so that the heap lock is only taken once per batch.
+// If the heap can't satisfy the allocation, the cache is flushed and the allocation is tried again.
+static void* cache_allocate(mcheap_t *heap, size_t size)
+{
+	struct used_struct *used_ptr;
+	void* retval = NULL;
+	size_t content_size = enforce_minimum_allocation_size(size);
+	int bin, count;
+
+	cache_prepare(heap);
+	if(content_size <= MCHEAP_THREAD_CACHE_MAX)
+	{
+		bin = cache_bin(content_size);
+		if(!thread_cache.bins[bin])
+		{
+			LOCK(heap);
+			retval = region_allocate(heap, content_size);
+			for(count = 1; retval && count < CACHE_BATCH && thread_cache.bytes + content_size <= MCHEAP_THREAD_CACHE_BYTES; count++)
+			{
+				used_ptr = region_allocate(heap, content_size);
+				if(!used_ptr)
+					break;
+				used_ptr = container_of(used_ptr, struct used_struct, content);
+				if(CONTENT_SIZE(used_ptr) <= MCHEAP_THREAD_CACHE_MAX && thread_cache.counts[cache_bin(CONTENT_SIZE(used_ptr))] < MCHEAP_THREAD_CACHE_COUNT)
+					cache_push(used_ptr->content, CONTENT_SIZE(used_ptr));
+				else
+					region_free(heap, used_ptr->content);
+			};
+			UNLOCK(heap);
+		}
+		else
+		{
+			retval = thread_cache.bins[bin];
+			thread_cache.bins[bin] = *(void**)retval;
+			thread_cache.counts[bin]--;
+			thread_cache.bytes -= content_size;
+		};
+	}
+	else
+	{
+		LOCK(heap);
+		retval = region_allocate(heap, content_size);
+		UNLOCK(heap);
+	};
+
+	if(!retval)
+	{
+		LOCK(heap);
+		cache_flush(&thread_cache);
+		retval = region_allocate(heap, content_size);
+		UNLOCK(heap);
+	};
+
+	return retval;
+}
+
+// Reallocate through the calling threads cache
+// Only allocating (section == NULL) and freeing (new_size == 0) use the cache, other reallocations always use the heap
+static void* cache_reallocate(mcheap_t *heap, void* section, size_t new_size, size_t preserve_size)
+{
+	void* retval = NULL;
+
+	if(section == NULL)
+		retval = cache_allocate(heap, new_size);
+	else if(new_size == 0)
+		cache_free(heap, section, 0);
+	else
+	{
+		cache_prepare(heap);
+		LOCK(heap);
+		retval = region_reallocate(heap, section, new_size, preserve_size);
+		if(!retval)
+		{
+			cache_flush(&thread_cache);
+			retval = region_reallocate(heap, section, new_size, preserve_size);
+		};
+		UNLOCK(heap);
+	};
+
+	return retval;
+}
+
+// Free through the calling threads cache
+// If the allocation doesn't fit in the cache, it is freed to the heap along with a batch from it's bin, under the same lock.
+// content_size is the aligned size known by the caller, which may be less than the content of the section, or 0 to read it from the section.
+static void cache_free(mcheap_t *heap, void* section, size_t content_size)
+{
+	int bin;
+
+	if(section)
+	{
+		cache_prepare(heap);
+		if(!content_size)
+			content_size = CONTENT_SIZE(USEDCAST(container_of(section, struct used_struct, content)));
+		if(content_size <= MCHEAP_THREAD_CACHE_MAX)
+		{
+			bin = cache_bin(content_size);
+			if(thread_cache.counts[bin] < MCHEAP_THREAD_CACHE_COUNT && thread_cache.bytes + content_size <= MCHEAP_THREAD_CACHE_BYTES)
+				cache_push(section, content_size);
+			else
+			{
+				LOCK(heap);
+				region_free(heap, section);
+				cache_flush_bin(heap, bin, CACHE_BATCH);
+				UNLOCK(heap);
+			};
+		}
+		else
+		{
+			LOCK(heap);
+			region_free(heap, section);
+			UNLOCK(heap);
+		};
+	};
+}
+
+// Return up to count allocations from a bin to the heap, the heap lock must be held
+static void cache_flush_bin(mcheap_t *heap, int bin, int count)
+{
+	void* section;
+
+	while(count-- && thread_cache.bins[bin])
+	{
+		section = thread_cache.bins[bin];
+		thread_cache.bins[bin] = *(void**)section;
+		thread_cache.counts[bin]--;
+		thread_cache.bytes -= (size_t)(bin + 1) * MCHEAP_ALIGNMENT;	// the content size of the bin, which the section may exceed
+		region_free(heap, section);
+	};
+}
+
+// Return all allocations in the cache to the heap, the heap lock must be held
+// This takes the cache as an argument, as the thread local cache may no longer be addressable from a key destructor
+static void cache_flush(struct thread_cache_struct *cache)
+{
+	mcheap_t *heap = cache->heap;
+	void* section;
+	int bin;
+
+	if(cache->generation == heap->generation)
+	{
+		for(bin = 0; bin != CACHE_BIN_COUNT; bin++)
+		{
+			while(cache->bins[bin])
+			{
+				section = cache->bins[bin];
+				cache->bins[bin] = *(void**)section;
+				region_free(heap, section);
+			};
+			cache->counts[bin] = 0;
+		};
+		cache->bytes = 0;
+	};
+}
+
+// Discard the cache if the heap has been re-initialized, and arrange for it to be flushed when the thread exits
+// The allocations in a discarded cache no longer exist, so they must not be freed.
+// A cache holds the allocations of one heap at a time, so it is flushed to it's previous heap when the thread uses another.
+// The heap lock must not be held.
+static void cache_prepare(mcheap_t *heap)
+{
+	if(!thread_cache.registered)
+	{
+	#ifndef MCHEAP_NO_PTHREAD
+		pthread_once(&cache_key_once, cache_key_create);
+		pthread_setspecific(cache_key, &thread_cache);
+	#endif
+		thread_cache.registered = true;
+	};
+
+	if(thread_cache.heap && thread_cache.heap != heap)
+	{
+		LOCK(thread_cache.heap);
+		cache_flush(&thread_cache);
+		UNLOCK(thread_cache.heap);
+	};
+
+	if(thread_cache.heap != heap || thread_cache.generation != heap->generation)
+	{
+		memset(thread_cache.bins, 0, sizeof(thread_cache.bins));
+		memset(thread_cache.counts, 0, sizeof(thread_cache.counts));
+		thread_cache.bytes = 0;
+		thread_cache.heap = heap;
+		thread_cache.generation = heap->generation;
+	};
+}
+
+// Add an allocation to the cache, it must fit in the cache
+static void cache_push(void* section, size_t content_size)
+{
+	int bin = cache_bin(content_size);
+
+	*(void**)section = thread_cache.bins[bin];
+	thread_cache.bins[bin] = section;
+	thread_cache.counts[bin]++;
+	thread_cache.bytes += content_size;
+}
+
+// Return the bin for a content size, which must be aligned and not exceed MCHEAP_THREAD_CACHE_MAX
+static int cache_bin(size_t content_size)
+{
+	return (int)(content_size / MCHEAP_ALIGNMENT) - 1;
+}
+
+	#ifndef MCHEAP_NO_PTHREAD
+// Called on thread exit with the exiting threads cache
+static void cache_destructor(void* cache)
+{
+	mcheap_t *heap = ((struct thread_cache_struct*)cache)->heap;
+
+	if(heap)
+	{
+		LOCK(heap);
+		cache_flush(cache);
+		UNLOCK(heap);
+	};
+}
+
+// Create the key used to call cache_destructor()
+static void cache_key_create(void)
+{
+	pthread_key_create(&cache_key, cache_destructor);
+}
+	#endif
+
+#endif
+
+//********************************************************************************************************
+// Small object (slab) layer
+//********************************************************************************************************
+
+#ifdef MCHEAP_SLAB
+
+// Allocate an object from the slab layer, returns NULL if size is too large or no slab can be created
+// The first slab of the class always has a free object, so this takes constant time unless a new slab is needed
+static void* slab_allocate(mcheap_t *heap, size_t size)
+{
+	struct slab_struct *slab;
+	void* retval = NULL;
+	int size_class;
+
+	if(size <= MCHEAP_SLAB_MAX)
+	{
+		size_class = slab_class(size);
+		slab = heap->slab_partial[size_class];
+		if(!slab)
+			slab = slab_create(heap, size_class);
+
+		if(slab)
+		{
+			retval = slab->free_objects;
+			slab->free_objects = *(void**)retval;
+			slab->used_count++;
+			if(!slab->free_objects)
+				slab_unlink(heap, slab);	// full
+		};
+	};
+
+	return retval;
+}
+
+// Reallocate an object of a slab, moving it if the new size doesn't fit it's size class
+// A smaller size stays in place, as the object can't be shrunk.
+static void* slab_reallocate(mcheap_t *heap, struct slab_struct *slab, void* object, size_t new_size, size_t preserve_size)
+{
+	void* retval = NULL;
+
+	if(new_size == 0)
+		slab_free(heap, slab, object);
+	else if(new_size <= slab->object_size)
+		retval = object;
+	else
+	{
+		retval = slab_allocate(heap, new_size);
+		if(!retval)
+			retval = region_allocate(heap, new_size);
+		if(retval)
+		{
+			memcpy(retval, object, SMALLEST_OF(preserve_size, slab->object_size));
+			slab_free(heap, slab, object);
+		};
+	};
+
+	return retval;
+}
+
+// Return an object to it's slab, and release the slab to the heap if it becomes empty
+static void slab_free(mcheap_t *heap, struct slab_struct *slab, void* object)
+{
+	if(!slab->free_objects)
+		slab_link(heap, slab);	// was full
+
+	*(void**)object = slab->free_objects;
+	slab->free_objects = object;
+	slab->used_count--;
+
+	if(!slab->used_count)
+		slab_release(heap, slab);
+}
+
+// Return the slab holding an allocation, or NULL if the allocation was made from the heap
+// Slabs are at least one chunk apart, so the only candidates are the slabs starting in the same chunk as ptr, or the chunk before it.
+static struct slab_struct* slab_of(mcheap_t *heap, void* ptr)
+{
+	mcheap_t *region = region_of(heap, ptr);
+	struct slab_struct *retval = NULL;
+	struct slab_struct *slab;
+	size_t chunk;
+
+	if(region)
+	{
+		chunk = slab_chunk(region, ptr);
+		slab = region->slab_map[chunk];
+		if(slab && (uint8_t*)ptr >= slab->content && (uint8_t*)ptr < &slab->content[SLAB_CONTENT_SIZE])
+			retval = slab;
+		else if(chunk)
+		{
+			slab = region->slab_map[chunk-1];
+			if(slab && (uint8_t*)ptr >= slab->content && (uint8_t*)ptr < &slab->content[SLAB_CONTENT_SIZE])
+				retval = slab;
+		};
+	};
+
+	return retval;
+}
+
+// Allocate a new slab from the heap for a size class, and add it to the list of slabs with free objects
+// Returns NULL if the heap has no space, or MCHEAP_SLAB_SIZE is too small to hold an object of the class
+// The slab is always a section of a region, never it's own mapping, as the slab map of the region must find it
+static struct slab_struct* slab_create(mcheap_t *heap, int size_class)
+{
+	mcheap_t *region;
+	struct slab_struct *slab = NULL;
+	size_t object_size = (size_t)(size_class + 1) * MCHEAP_ALIGNMENT;
+	size_t offset;
+
+	if(SLAB_CONTENT_SIZE >= object_size)
+		for(region = heap->first_region; region && !slab; region = region->next_region)
+			slab = allocate(region, MCHEAP_SLAB_SIZE - sizeof(struct used_struct), false);
+
+	if(slab)
+	{
+		slab->object_size = object_size;
+		slab->used_count = 0;
+
+		// link the objects from the highest to the lowest, so that the lowest is allocated first
+		slab->free_objects = NULL;
+		offset = (SLAB_CONTENT_SIZE / object_size) * object_size;
+		while(offset)
+		{
+			offset -= object_size;
+			*(void**)&slab->content[offset] = slab->free_objects;
+			slab->free_objects = &slab->content[offset];
+		};
+
+		region = region_of(heap, slab);
+		region->slab_map[slab_chunk(region, slab)] = slab;
+		slab_link(heap, slab);
+	};
+
+	return slab;
+}
+
+// Unlink an empty slab from it's class and return it to the heap
+static void slab_release(mcheap_t *heap, struct slab_struct *slab)
+{
+	mcheap_t *region = region_of(heap, slab);
+
+	slab_unlink(heap, slab);
+	region->slab_map[slab_chunk(region, slab)] = NULL;
+	region_free(heap, slab);
+}
+
+// Add a slab to the list of slabs with free objects in it's class
+static void slab_link(mcheap_t *heap, struct slab_struct *slab)
+{
+	struct slab_struct **head_ptr = &heap->slab_partial[slab_class(slab->object_size)];
+
+	slab->prev_ptr = NULL;
+	slab->next_ptr = *head_ptr;
+	if(slab->next_ptr)
+		slab->next_ptr->prev_ptr = slab;
+	*head_ptr = slab;
+}
+
+// Remove a slab from the list of slabs with free objects in it's class
+static void slab_unlink(mcheap_t *heap, struct slab_struct *slab)
+{
+	if(slab->prev_ptr)
+		slab->prev_ptr->next_ptr = slab->next_ptr;
+	else
+		heap->slab_partial[slab_class(slab->object_size)] = slab->next_ptr;
+
+	if(slab->next_ptr)
+		slab->next_ptr->prev_ptr = slab->prev_ptr;
+}
+
+// Return the size class for an allocation size, size must not exceed MCHEAP_SLAB_MAX
+static int slab_class(size_t size)
+{
+	return size ? (int)((size - 1) / MCHEAP_ALIGNMENT) : 0;
+}
+
+// Return the chunk of a region in which ptr lies
+static size_t slab_chunk(mcheap_t *heap, void* ptr)
+{
+	return (size_t)((uint8_t*)ptr - heap->start) / MCHEAP_SLAB_SIZE;
+}
+
+#endif
+
+//********************************************************************************************************
+// Free list engine, a single address ordered list (default)
+//********************************************************************************************************
+
+#ifdef ENGINE_LIST
+
+#ifndef BOUNDARY_TAGS
+// Find free below
+// Find the last free section before target section (either type), if there is one
+// Otherwise return NULL
+static struct free_struct* find_free_below(mcheap_t *heap, void* target)
+{
+	struct free_struct *free_ptr;
+	struct free_struct *retval=NULL;
+
+	free_ptr = FIRST_FREE(heap);
+	while(free_ptr && ((void*)free_ptr < target))
+	{
+		retval = free_ptr;
+		free_ptr = NEXT_FREE(heap, free_ptr);
+	};
+
+	return retval;	
+}
+#endif
+
+// Walk the free list for allocation (or re-allocation)
+// Find a free section capable of holding 'size' bytes as a used section, according to the placement policy
+// MCHEAP_FIRST_FIT and MCHEAP_NEXT_FIT stop at the first fit, MCHEAP_BEST_FIT stops at an exact fit, MCHEAP_WORST_FIT walks every section.
+static struct free_struct* free_walk(mcheap_t *heap, size_t size)
+{
+	struct free_struct *free_ptr;
+	struct free_struct *retval = NULL;
+	size_t needed = sizeof(struct used_struct) + size;
+
+	switch(heap->placement)
+	{
+		case MCHEAP_NEXT_FIT:
+			// search from the rover to the end of the list, then from the start of the list up to the rover
+			free_ptr = heap->rover ? heap->rover : FIRST_FREE(heap);
+			while(free_ptr && SECTION_SIZE(free_ptr) < needed)
+				free_ptr = NEXT_FREE(heap, free_ptr);
+			if(!free_ptr && heap->rover)
+			{
+				free_ptr = FIRST_FREE(heap);
+				while(free_ptr != heap->rover && SECTION_SIZE(free_ptr) < needed)
+					free_ptr = NEXT_FREE(heap, free_ptr);
+				if(free_ptr == heap->rover)
+					free_ptr = NULL;
+			};
+			if(free_ptr)
+				heap->rover = free_ptr;
+			retval = free_ptr;
+			break;
+
+		case MCHEAP_BEST_FIT:
+			free_ptr = FIRST_FREE(heap);
+			while(free_ptr && !(retval && SECTION_SIZE(retval) == needed))
+			{
+				if(SECTION_SIZE(free_ptr) >= needed && (!retval || SECTION_SIZE(free_ptr) < SECTION_SIZE(retval)))
+					retval = free_ptr;
+				free_ptr = NEXT_FREE(heap, free_ptr);
+			};
+			break;
+
+		case MCHEAP_WORST_FIT:
+			free_ptr = FIRST_FREE(heap);
+			while(free_ptr)
+			{
+				if(!retval || SECTION_SIZE(free_ptr) > SECTION_SIZE(retval))
+					retval = free_ptr;
+				free_ptr = NEXT_FREE(heap, free_ptr);
+			};
+			if(retval && SECTION_SIZE(retval) < needed)
+				retval = NULL;
+			break;
+
+		default:
+			free_ptr = FIRST_FREE(heap);
+			while(free_ptr && SECTION_SIZE(free_ptr) < needed)
+				free_ptr = NEXT_FREE(heap, free_ptr);
+			retval = free_ptr;
 	};
+
 	return retval;
 }
 
-// relocate of realloc
-// dest_ptr must be a suitable free section capable of allocating new_size bytes.
-// removes dest_ptr from the free list, moves src_ptr to dest_ptr, and adds src_ptr to the free list
-// preserves at most new_size bytes
-// returns the new used section at dest_ptr, does not shrink the destination.
-static struct used_struct* relocate(struct free_struct* dest_ptr, struct used_struct* src_ptr, size_t new_size)
+// Insert a free section into the free list
+// Walks the free list to find the insertion point
+static void free_insert(mcheap_t *heap, struct free_struct *new_free)
 {
-	struct used_struct* new_used_ptr;
-	struct free_struct* new_free_ptr;
-	free_remove(dest_ptr);
-	new_used_ptr = free_to_used(dest_ptr);
-	memcpy(new_used_ptr->content, src_ptr->content, SMALLEST_OF(new_size, src_ptr->size));
-	new_free_ptr = used_to_free(src_ptr);
-	free_insert(new_free_ptr);	// insert it into the free list
-	free_merge(new_free_ptr);	// and merge with adjacent free sections
-	return new_used_ptr;
+	free_link_t *link_ptr;
+
+	link_ptr = &heap->first_free;
+
+	//walk the links, until we find a link which points past the new_free section, or we find the end of the list
+	while(*link_ptr && LINK_TO_FREE(heap, *link_ptr) < new_free)
+		link_ptr = &LINK_TO_FREE(heap, *link_ptr)->next_ptr;	//link_ptr == the address of the next link
+
+	//the new link points to what the previous link pointed to
+	new_free->next_ptr = (*link_ptr);
+
+	//the previous link points to the new free section
+	(*link_ptr) = FREE_TO_LINK(heap, new_free);
 }
 
-static void* internal_free(void* section)
+// Remove a free section from the free list
+// Walks the free list to find the link to modify
+static void free_remove(mcheap_t *heap, struct free_struct *free_ptr)
 {
-	struct used_struct *used_ptr;
+	free_link_t *link_ptr;
+	link_ptr = &heap->first_free;
+
+	// Find the link that points to this section
+	while(LINK_TO_FREE(heap, *link_ptr) != free_ptr)
+		link_ptr = &LINK_TO_FREE(heap, *link_ptr)->next_ptr;	//link_ptr == the address of the next link
+
+	// If the rover is removed, move it back to the section below, so that the next search will reach any remainder of this section
+	if(heap->rover == free_ptr)
+		heap->rover = (link_ptr == &heap->first_free) ? NULL : container_of(link_ptr, struct free_struct, next_ptr);
+
+	// Remove it
+	(*link_ptr) = free_ptr->next_ptr;
+}
+
+// Return count free sections, sorted by address, to the free list, and merge them with adjacent free sections
+// The free list is walked once for all of them, as each section is inserted after the one before it
+static void free_release_sorted(mcheap_t *heap, void** sections, size_t count)
+{
+	free_link_t *link_ptr = &heap->first_free;
+	struct free_struct *below = NULL;
 	struct free_struct *free_ptr;
+	size_t i;
+#if defined(MCHEAP_TRIM) && MCHEAP_TRIM_THRESHOLD
+	void* end;
+#endif
 
-	if(!initialized)
-		initialize();
+	for(i = 0; i != count; i++)
+	{
+		free_ptr = sections[i];
+	#if defined(MCHEAP_TRIM) && MCHEAP_TRIM_THRESHOLD
+		end = SECTION_AFTER(free_ptr);
+	#endif
 
-	if(section != NULL)
+		//continue the walk from the previous section, below is the section holding link_ptr
+		while(*link_ptr && LINK_TO_FREE(heap, *link_ptr) < free_ptr)
+		{
+			below = LINK_TO_FREE(heap, *link_ptr);
+			link_ptr = &below->next_ptr;
+		};
+
+		free_ptr->next_ptr = (*link_ptr);
+		(*link_ptr) = FREE_TO_LINK(heap, free_ptr);
+		free_merge_up(heap, free_ptr);
+		if(below && SECTION_AFTER(below) == (void*)free_ptr)
+		{
+			free_merge_up(heap, below);
+			free_ptr = below;
+		};
+		below = free_ptr;
+		link_ptr = &free_ptr->next_ptr;
+
+	#if defined(MCHEAP_TRIM) && MCHEAP_TRIM_THRESHOLD
+		free_trim_released(heap, free_ptr, sections[i], end);
+	#endif
+	};
+}
+
+// Merge free section into the next free section if possible
+static void free_merge_up(mcheap_t *heap, struct free_struct *free_ptr)
+{
+	struct free_struct *next_ptr = NEXT_FREE(heap, free_ptr);
+
+	//if there is a free section after this one
+	if(next_ptr)
+	{
+		//if the next free section is at the end of this free section
+		if((void*)next_ptr == SECTION_AFTER(free_ptr))
+		{
+
+			//the rover can't be left in the next section
+			if(heap->rover == next_ptr)
+				heap->rover = free_ptr;
+
+			//copy next free sections link to this section, before it's meta data becomes content
+			free_ptr->next_ptr = next_ptr->next_ptr;
+
+			//increase size of this free section, by total size of next section
+			free_grow(heap, free_ptr, SECTION_SIZE(next_ptr));
+		};
+	};
+}
+
+// Grow a free section which is in the free list by size bytes
+// The address of the section doesn't change, so it can stay where it is in the list
+static void free_grow(mcheap_t *heap, struct free_struct *free_ptr, size_t size)
+{
+	ZERO_MERGE(free_ptr);
+	free_ptr->size += size;
+	TAG_NEXT(heap, free_ptr);
+}
+
+// Find largest free block. Used for tracking heap headroom.
+static size_t free_find_largest(mcheap_t *heap)
+{
+	struct free_struct *free_ptr;
+	size_t largest=0;
+
+	if(heap->first_free)
+	{
+		free_ptr = FIRST_FREE(heap);
+		while(free_ptr)
+		{
+			if(CONTENT_SIZE(free_ptr) > largest)
+				largest = CONTENT_SIZE(free_ptr);
+			free_ptr = NEXT_FREE(heap, free_ptr);
+		};
+
+	//	convert to allocatable content size
+		largest += sizeof(struct free_struct);
+		if(largest >= sizeof(struct used_struct))
+			largest -= sizeof(struct used_struct);
+	};
+
+	return largest;
+}
+
+#endif
+
+//********************************************************************************************************
+// Free list engine, segregated size classes
+//********************************************************************************************************
+
+#ifdef MCHEAP_ENGINE_SEGREGATED
+
+#ifndef BOUNDARY_TAGS
+// Find free below
+// Find the last free section before target section (either type), if there is one
+// Otherwise return NULL
+// Each bin is address ordered, so only the leading part of each bin needs to be walked
+static struct free_struct* find_free_below(mcheap_t *heap, void* target)
+{
+	struct free_struct *free_ptr;
+	struct free_struct *retval=NULL;
+	size_t map = heap->bin_map;
+	int bin;
+
+	while(map)
+	{
+		bin = lowest_bit(map);
+		map &= map - 1;
+		free_ptr = heap->bins[bin];
+		while(free_ptr && ((void*)free_ptr < target))
+		{
+			if(free_ptr > retval)
+				retval = free_ptr;
+			free_ptr = free_ptr->next_ptr;
+		};
+	};
+
+	return retval;
+}
+#endif
+
+// Walk the free list for allocation (or re-allocation)
+// Find a free section capable of holding 'size' bytes as a used section
+// The lowest non-empty bin in which every section fits is found from the bin map, and it's first (lowest address) section is taken.
+// Only if there is no such bin, is the bin which may hold a fitting section walked.
+static struct free_struct* free_walk(mcheap_t *heap, size_t size)
+{
+	struct free_struct *free_ptr;
+	size_t needed = sizeof(struct used_struct) + size;
+	size_t map;
+	int bin;
+
+	bin = floor_log2(needed);
+	if(needed & (needed - 1))
+		map = (bin + 1 < heap->bin_count) ? heap->bin_map & (~(size_t)0 << (bin + 1)) : 0;
+	else
+		map = heap->bin_map & (~(size_t)0 << bin);
+
+	if(map)
+		free_ptr = heap->bins[lowest_bit(map)];
+	else
+	{
+		free_ptr = (bin < heap->bin_count) ? heap->bins[bin] : NULL;
+		while(free_ptr && SECTION_SIZE(free_ptr) < needed)
+			free_ptr = free_ptr->next_ptr;
+	};
+
+	return free_ptr;
+}
+
+// Insert a free section into the free list
+// Walks the sections bin to find the insertion point
+static void free_insert(mcheap_t *heap, struct free_struct *new_free)
+{
+	struct free_struct **link_ptr;
+	int bin = bin_of(new_free);
+
+	link_ptr = &heap->bins[bin];
+
+	//walk the links, until we find a link which points past the new_free section, or we find the end of the bin
+	while(*link_ptr && *link_ptr < new_free)
+		link_ptr = &(*link_ptr)->next_ptr;
+
+	new_free->next_ptr = (*link_ptr);
+	(*link_ptr) = new_free;
+	heap->bin_map |= (size_t)1 << bin;
+}
+
+// Remove a free section from the free list
+// Walks the sections bin to find the link to modify
+static void free_remove(mcheap_t *heap, struct free_struct *free_ptr)
+{
+	struct free_struct **link_ptr;
+	int bin = bin_of(free_ptr);
+
+	link_ptr = &heap->bins[bin];
+
+	// Find the link that points to this section
+	while(*link_ptr != free_ptr)
+		link_ptr = &(*link_ptr)->next_ptr;
+
+	// Remove it
+	(*link_ptr) = free_ptr->next_ptr;
+	if(!heap->bins[bin])
+		heap->bin_map &= ~((size_t)1 << bin);
+}
+
+// Find largest free block. Used for tracking heap headroom.
+// The largest section is in the highest non-empty bin
+static size_t free_find_largest(mcheap_t *heap)
+{
+	struct free_struct *free_ptr;
+	size_t largest=0;
+
+	if(heap->bin_map)
+	{
+		free_ptr = heap->bins[floor_log2(heap->bin_map)];
+		while(free_ptr)
+		{
+			if(CONTENT_SIZE(free_ptr) > largest)
+				largest = CONTENT_SIZE(free_ptr);
+			free_ptr = free_ptr->next_ptr;
+		};
+
+	//	convert to allocatable content size
+		largest += sizeof(struct free_struct);
+		if(largest >= sizeof(struct used_struct))
+			largest -= sizeof(struct used_struct);
+	};
+
+	return largest;
+}
+
+// Return the bin a free section belongs in
+static int bin_of(struct free_struct *free_ptr)
+{
+	return floor_log2(SECTION_SIZE(free_ptr));
+}
+
+#endif
+
+//********************************************************************************************************
+// Free list engine, two level segregated fit (TLSF)
+//********************************************************************************************************
+
+#ifdef MCHEAP_ENGINE_TLSF
+
+// Walk the free list for allocation (or re-allocation)
+// Find a free section capable of holding 'size' bytes as a used section
+// The size is rounded up to the next size class, so that the head of any non-empty list found from the bitmaps is a fit.
+// Only if there is no such list, is the list which may hold a fitting section walked.
+static struct free_struct* free_walk(mcheap_t *heap, size_t size)
+{
+	struct free_struct *free_ptr = NULL;
+	size_t needed = sizeof(struct used_struct) + size;
+	size_t rounded = needed;
+	size_t fl_bits;
+	uint32_t sl_bits = 0;
+	int fl, sl;
+
+	if(rounded >= SMALL_SIZE)
+		rounded += ((size_t)1 << (floor_log2(rounded) - MCHEAP_TLSF_SL_BITS)) - 1;
+	tlsf_mapping(rounded, &fl, &sl);
+
+	if(fl < heap->fl_count)
+	{
+		sl_bits = heap->sl_map[fl] & (~(uint32_t)0 << sl);
+		if(!sl_bits)
+		{
+			fl_bits = (fl + 1 < heap->fl_count) ? heap->fl_map & (~(size_t)0 << (fl + 1)) : 0;
+			if(fl_bits)
+			{
+				fl = lowest_bit(fl_bits);
+				sl_bits = heap->sl_map[fl];
+			};
+		};
+	};
+
+	if(sl_bits)
+		free_ptr = heap->tlsf_lists[fl][lowest_bit(sl_bits)];
+	else
+	{
+		tlsf_mapping(needed, &fl, &sl);
+		if(fl < heap->fl_count)
+		{
+			free_ptr = heap->tlsf_lists[fl][sl];
+			while(free_ptr && SECTION_SIZE(free_ptr) < needed)
+				free_ptr = free_ptr->next_ptr;
+		};
+	};
+
+	return free_ptr;
+}
+
+// Insert a free section into the free list
+// The section is added to the head of the list for it's size class
+static void free_insert(mcheap_t *heap, struct free_struct *new_free)
+{
+	int fl, sl;
+
+	tlsf_mapping(SECTION_SIZE(new_free), &fl, &sl);
+
+	new_free->prev_ptr = NULL;
+	new_free->next_ptr = heap->tlsf_lists[fl][sl];
+	if(new_free->next_ptr)
+		new_free->next_ptr->prev_ptr = new_free;
+	heap->tlsf_lists[fl][sl] = new_free;
+
+	heap->sl_map[fl] |= (uint32_t)1 << sl;
+	heap->fl_map |= (size_t)1 << fl;
+}
+
+// Remove a free section from the free list
+static void free_remove(mcheap_t *heap, struct free_struct *free_ptr)
+{
+	int fl, sl;
+
+	tlsf_mapping(SECTION_SIZE(free_ptr), &fl, &sl);
+
+	if(free_ptr->next_ptr)
+		free_ptr->next_ptr->prev_ptr = free_ptr->prev_ptr;
+	if(free_ptr->prev_ptr)
+		free_ptr->prev_ptr->next_ptr = free_ptr->next_ptr;
+	else
+	{
+		heap->tlsf_lists[fl][sl] = free_ptr->next_ptr;
+		if(!heap->tlsf_lists[fl][sl])
+		{
+			heap->sl_map[fl] &= ~((uint32_t)1 << sl);
+			if(!heap->sl_map[fl])
+				heap->fl_map &= ~((size_t)1 << fl);
+		};
+	};
+}
+
+// Find largest free block. Used for tracking heap headroom.
+// The largest section is in the highest non-empty list
+static size_t free_find_largest(mcheap_t *heap)
+{
+	struct free_struct *free_ptr;
+	size_t largest=0;
+	int fl;
+
+	if(heap->fl_map)
+	{
+		fl = floor_log2(heap->fl_map);
+		free_ptr = heap->tlsf_lists[fl][floor_log2(heap->sl_map[fl])];
+		while(free_ptr)
+		{
+			if(CONTENT_SIZE(free_ptr) > largest)
+				largest = CONTENT_SIZE(free_ptr);
+			free_ptr = free_ptr->next_ptr;
+		};
+
+	//	convert to allocatable content size
+		largest += sizeof(struct free_struct);
+		if(largest >= sizeof(struct used_struct))
+			largest -= sizeof(struct used_struct);
+	};
+
+	return largest;
+}
+
+// Return the first and second level list indexes for a section size
+static void tlsf_mapping(size_t size, int *fl, int *sl)
+{
+	int log2_size;
+
+	if(size < SMALL_SIZE)
+	{
+		*fl = 0;
+		*sl = (int)(size >> ALIGN_SHIFT);
+	}
+	else
 	{
-		used_ptr = container_of(section, struct used_struct, content);
-			
-		free_ptr = used_to_free(used_ptr);	//convert to free section
-		free_insert(free_ptr);				//insert into the free list
-		free_merge(free_ptr);				//merge with adjacent free sections
+		log2_size = floor_log2(size);
+		*sl = (int)(size >> (log2_size - MCHEAP_TLSF_SL_BITS)) ^ SL_COUNT;
+		*fl = log2_size - FL_SHIFT + 1;
 	};
-	return NULL;
 }
 
-// Shrink used section so that it's content is reduced to the new_size.
-// This will only happen if doing so allows a new free section to be created.
-// new_size should be pre-aligned by the caller
-// If created, the new free section will be inserted into the free list, and merged if possible
-static void used_shrink(struct used_struct *used_ptr, size_t new_size)
+#endif
+
+//********************************************************************************************************
+// Free list engine, address ordered AVL tree
+//********************************************************************************************************
+
+#ifdef MCHEAP_ENGINE_TREE
+
+#ifndef BOUNDARY_TAGS
+// Find free below
+// Find the last free section before target section (either type), if there is one
+// Otherwise return NULL
+static struct free_struct* find_free_below(mcheap_t *heap, void* target)
 {
-	struct free_struct *free_ptr;
+	struct free_struct *node = heap->tree_root;
+	struct free_struct *retval = NULL;
 
-	if(new_size < used_ptr->size)
+	while(node)
 	{
-		// If this section is large enough for used meta + new_size + free meta
-		if(SECTION_SIZE(used_ptr) >= sizeof(struct used_struct) + new_size + sizeof(struct free_struct))
+		if((void*)node < target)
 		{
-			//remaining free section will start at the end of the shrunken used section
-			free_ptr = (void*)&(used_ptr->content[new_size]);
+			retval = node;
+			node = node->right_ptr;
+		}
+		else
+			node = node->left_ptr;
+	};
 
-			//construct remaining free section
-			free_ptr->size = used_ptr->size - new_size - sizeof(struct free_struct);
+	return retval;
+}
+#endif
 
-			//shrink used section
-			used_ptr->size = new_size;
+// Walk the free list for allocation (or re-allocation)
+// Find the lowest addressed free section capable of holding 'size' bytes as a used section
+// The largest section size held in each subtree shows which way to descend, without visiting sections which don't fit.
+static struct free_struct* free_walk(mcheap_t *heap, size_t size)
+{
+	struct free_struct *node = heap->tree_root;
+	struct free_struct *retval = NULL;
+	size_t needed = sizeof(struct used_struct) + size;
 
-			free_insert(free_ptr);
-			free_merge_up(free_ptr);
-		};
+	if(node && node->max_size < needed)
+		node = NULL;
+
+	while(node && !retval)
+	{
+		if(node->left_ptr && node->left_ptr->max_size >= needed)
+			node = node->left_ptr;
+		else if(SECTION_SIZE(node) >= needed)
+			retval = node;
+		else
+			node = node->right_ptr;
 	};
+
+	return retval;
 }
 
-// Convert a used section to a free section, does not insert into the free list
-// Returns the result
-static struct free_struct* used_to_free(struct used_struct *used_ptr)
+// Insert a free section into the free list
+static void free_insert(mcheap_t *heap, struct free_struct *new_free)
 {
-	struct free_struct *free_ptr;
+	new_free->left_ptr = NULL;
+	new_free->right_ptr = NULL;
+	heap->tree_root = tree_insert(heap->tree_root, new_free);
+}
 
-//	Build new free section
-	free_ptr = (void*)used_ptr;
-	free_ptr->size = SECTION_SIZE(used_ptr) - sizeof(struct free_struct);
+// Remove a free section from the free list
+static void free_remove(mcheap_t *heap, struct free_struct *free_ptr)
+{
+	heap->tree_root = tree_remove(heap->tree_root, free_ptr);
+}
 
-	return free_ptr;
+// Grow a free section which is in the free list by size bytes
+// The address of the section doesn't change, so only the largest sizes on the path to it need updating
+static void free_grow(mcheap_t *heap, struct free_struct *free_ptr, size_t size)
+{
+	ZERO_MERGE(free_ptr);
+	free_ptr->size += size;
+	TAG_NEXT(heap, free_ptr);
+	tree_refresh(heap->tree_root, free_ptr);
 }
 
-// Convert a free section into a used section, free section must be removed from the free list beforehand
-// Returns the result
-static struct used_struct* free_to_used(struct free_struct *free_ptr)
+// Find largest free block. Used for tracking heap headroom.
+// The root holds the largest section size in the whole tree
+static size_t free_find_largest(mcheap_t *heap)
 {
-	struct used_struct *used_ptr;
+	size_t largest=0;
 
-//	Build new used section
-	used_ptr = (void*)free_ptr;
-	used_ptr->size = SECTION_SIZE(free_ptr) - sizeof(struct used_struct);
-	return used_ptr;
+	if(heap->tree_root)
+		largest = heap->tree_root->max_size - sizeof(struct used_struct);
+
+	return largest;
 }
 
-// Return true, if the used section can extend down into the free section to acheive the desired size
-static bool used_section_can_extend_down(struct free_struct* free_ptr, struct used_struct* used_ptr, size_t desired_size)
+// Insert new_free into the subtree at node, return the new root of the subtree
+static struct free_struct* tree_insert(struct free_struct *node, struct free_struct *new_free)
 {
-	return (free_ptr
-		&& (SECTION_AFTER(free_ptr) == used_ptr)
-		&& (used_ptr->size + SECTION_SIZE(free_ptr) >= desired_size));
+	if(!node)
+	{
+		tree_update(new_free);
+		node = new_free;
+	}
+	else
+	{
+		if(new_free < node)
+			node->left_ptr = tree_insert(node->left_ptr, new_free);
+		else
+			node->right_ptr = tree_insert(node->right_ptr, new_free);
+		node = tree_rebalance(node);
+	};
+	return node;
 }
 
-// Return true, if the used section can extend up into a free section to acheive the desired size
-static bool used_section_can_extend_up(struct used_struct* used_ptr, size_t desired_size)
+// Remove free_ptr from the subtree at node, return the new root of the subtree
+static struct free_struct* tree_remove(struct free_struct *node, struct free_struct *free_ptr)
 {
-	struct free_struct* free_ptr = SECTION_AFTER(used_ptr);
+	struct free_struct *successor;
 
-	return (in_free_list(free_ptr)
-		&& (used_ptr->size + SECTION_SIZE(free_ptr) >= desired_size) );
+	if(free_ptr < node)
+		node->left_ptr = tree_remove(node->left_ptr, free_ptr);
+	else if(free_ptr > node)
+		node->right_ptr = tree_remove(node->right_ptr, free_ptr);
+	else if(!node->left_ptr)
+		return node->right_ptr;
+	else if(!node->right_ptr)
+		return node->left_ptr;
+	else
+	{
+		// replace the node with the lowest section of it's right subtree
+		successor = node->right_ptr;
+		while(successor->left_ptr)
+			successor = successor->left_ptr;
+		successor->right_ptr = tree_remove_lowest(node->right_ptr);
+		successor->left_ptr = node->left_ptr;
+		node = successor;
+	};
+	return tree_rebalance(node);
 }
 
-// Extend a used section into a lower free section, also moves content limited to 'preserve_size' bytes
-// Free section must be removed from the free list before calling this function
-// Returns the resulting used section
-static struct used_struct* used_extend_down(struct free_struct *free_ptr, struct used_struct *used_ptr, size_t preserve_size)
+// Remove the lowest section from the subtree at node, return the new root of the subtree
+static struct free_struct* tree_remove_lowest(struct free_struct *node)
 {
-	size_t extra_size;
-	size_t move_size;
+	if(!node->left_ptr)
+		return node->right_ptr;
+	node->left_ptr = tree_remove_lowest(node->left_ptr);
+	return tree_rebalance(node);
+}
 
-//	extra size
-	extra_size = SECTION_SIZE(free_ptr);
+// Update the largest section sizes on the path from node to free_ptr, after free_ptr has changed size
+static void tree_refresh(struct free_struct *node, struct free_struct *free_ptr)
+{
+	if(free_ptr < node)
+		tree_refresh(node->left_ptr, free_ptr);
+	else if(free_ptr > node)
+		tree_refresh(node->right_ptr, free_ptr);
+	tree_update(node);
+}
 
-	if( preserve_size + sizeof(struct used_struct) < SECTION_SIZE(used_ptr) )
-		move_size = preserve_size + sizeof(struct used_struct);
-	else
-		move_size = SECTION_SIZE(used_ptr);
+// Restore the balance of the subtree at node, if it's children differ in height by more than 1
+// Return the new root of the subtree
+static struct free_struct* tree_rebalance(struct free_struct *node)
+{
+	int balance;
 
-//	move used section down, including limited content
-	memmove(free_ptr, used_ptr, move_size);
-	used_ptr = (void*)free_ptr;
+	tree_update(node);
+	balance = tree_height(node->left_ptr) - tree_height(node->right_ptr);
+	if(balance > 1)
+	{
+		if(tree_height(node->left_ptr->left_ptr) < tree_height(node->left_ptr->right_ptr))
+			node->left_ptr = tree_rotate_left(node->left_ptr);
+		node = tree_rotate_right(node);
+	}
+	else if(balance < -1)
+	{
+		if(tree_height(node->right_ptr->right_ptr) < tree_height(node->right_ptr->left_ptr))
+			node->right_ptr = tree_rotate_right(node->right_ptr);
+		node = tree_rotate_left(node);
+	};
+	return node;
+}
 
-//	extend used section
-	used_ptr->size += extra_size;
+// Rotate the subtree at node to the left, return the new root of the subtree
+static struct free_struct* tree_rotate_left(struct free_struct *node)
+{
+	struct free_struct *pivot = node->right_ptr;
 
-	return used_ptr;
+	node->right_ptr = pivot->left_ptr;
+	tree_update(node);
+	pivot->left_ptr = node;
+	tree_update(pivot);
+	return pivot;
 }
 
-// Extend a used section into a higher free section
-// The higher free section must be removed from the free list before calling this function
-static struct used_struct* used_extend_up(struct used_struct *used_ptr)
+// Rotate the subtree at node to the right, return the new root of the subtree
+static struct free_struct* tree_rotate_right(struct free_struct *node)
 {
-	struct free_struct *free_ptr;
-	size_t ext_size;
+	struct free_struct *pivot = node->left_ptr;
 
-	free_ptr = SECTION_AFTER(used_ptr);
-	ext_size = SECTION_SIZE(free_ptr);
+	node->left_ptr = pivot->right_ptr;
+	tree_update(node);
+	pivot->right_ptr = node;
+	tree_update(pivot);
+	return pivot;
+}
 
-	used_ptr->size += ext_size;
+// Update the height and largest section size of node from it's children
+static void tree_update(struct free_struct *node)
+{
+	int left_height = tree_height(node->left_ptr);
+	int right_height = tree_height(node->right_ptr);
 
-	return used_ptr;
+	node->height = (size_t)(1 + (left_height > right_height ? left_height : right_height));
+	node->max_size = SECTION_SIZE(node);
+	if(node->left_ptr && node->left_ptr->max_size > node->max_size)
+		node->max_size = node->left_ptr->max_size;
+	if(node->right_ptr && node->right_ptr->max_size > node->max_size)
+		node->max_size = node->right_ptr->max_size;
 }
 
+// Return the height of the subtree at node, 0 for an empty subtree
+static int tree_height(struct free_struct *node)
+{
+	return node ? (int)node->height : 0;
+}
+
+#endif
+
+//********************************************************************************************************
+// Engine independent functions
+//********************************************************************************************************
+
+#ifdef BOUNDARY_TAGS
 // Find free below
-// Find the last free section before target section (either type), if there is one
-// Otherwise return NULL
-static struct free_struct* find_free_below(void* target)
+// Using the boundary tag, return the section below target if it is free, otherwise return NULL
+static struct free_struct* find_free_below(mcheap_t *heap, void* target)
 {
-	struct free_struct *free_ptr;
-	struct free_struct *retval=NULL;
+	struct free_struct *retval = NULL;
 
-	free_ptr = first_free;
-	while(free_ptr && ((void*)free_ptr < target))
+	if(USEDCAST(target)->prev_size)
 	{
-		retval = free_ptr;
-		free_ptr = free_ptr->next_ptr;
+		retval = target - USEDCAST(target)->prev_size;
+		if(!in_free_list(heap, retval))
+			retval = NULL;
 	};
 
-	return retval;	
+	return retval;
 }
 
-// Walk the free list for allocation (or re-allocation)
-// Find a free section capable of holding 'size' bytes as a used section
-static struct free_struct* free_walk(size_t size)
+// Set the boundary tag of a section to the total size of the section below it
+// If section is the end of the heap, the size of the last section is kept in the control block instead, so that a growing heap can tag the new section
+static void tag_section(mcheap_t *heap, void *section, size_t prev_size)
 {
-	struct free_struct *free_ptr;
+	if(section != END_OF_HEAP(heap))
+		USEDCAST(section)->prev_size = prev_size;
+	else
+		heap->top_size = prev_size;
+}
+#endif
 
-	free_ptr = first_free;	
-	while(free_ptr && SECTION_SIZE(free_ptr) < sizeof(struct used_struct)+size)
-		free_ptr = free_ptr->next_ptr;
+#ifdef MCHEAP_TRACK_ZERO
+// Keep the zero flag of a free section which is about to absorb the section after it, only if both are zero
+// The meta data of the absorbed section becomes content, so it is cleared. The absorbed section must already be out of the free list.
+static void zero_merge(struct free_struct *free_ptr)
+{
+	struct free_struct *next_ptr = SECTION_AFTER(free_ptr);
 
-	return free_ptr;
+	if((free_ptr->size & FLAG_ZERO) && (next_ptr->size & FLAG_ZERO))
+		memset(next_ptr, 0, sizeof(struct free_struct));
+	else
+		free_ptr->size &= ~FLAG_ZERO;
 }
+#endif
 
 // Return true if section is in the free list
-static bool in_free_list(struct free_struct *section)
+// Every free section has FLAG_FREE set, so the list does not need to be searched
+static bool in_free_list(mcheap_t *heap, struct free_struct *section)
 {
-	struct 	free_struct *free_ptr;
-	bool retval = false;
-
-	free_ptr = first_free;
-	while(free_ptr && !retval)
-	{
-		retval = (free_ptr == section);
-		free_ptr = free_ptr->next_ptr;
-	};
-	return retval;
+	(void)heap;
+	return !!(section->size & FLAG_FREE);
 }
 
-// Insert a free section into the free list
-// Walks the free list to find the insertion point
-static void free_insert(struct free_struct *new_free)
+#ifndef ENGINE_LIST
+// Return count free sections, sorted by address, to the free list, each with free_release()
+static void free_release_sorted(mcheap_t *heap, void** sections, size_t count)
 {
-	struct free_struct **link_ptr;
+	size_t i;
 
-	link_ptr = &first_free;
+	for(i = 0; i != count; i++)
+		free_release(heap, sections[i]);
+}
 
-	//walk the links, until we find a link which points past the new_free section, or we find the end of the list
-	while(*link_ptr && *link_ptr < new_free)
-		link_ptr = &(*link_ptr)->next_ptr;	//link_ptr == the address of the next link
+// Merge free section into the next free section if possible
+static void free_merge_up(mcheap_t *heap, struct free_struct *free_ptr)
+{
+	struct free_struct *next_ptr = SECTION_AFTER(free_ptr);
 
-	//the new link points to what the previous link pointed to
-	new_free->next_ptr = (*link_ptr);
+	if((void*)next_ptr != END_OF_HEAP(heap) && in_free_list(heap, next_ptr))
+	{
+		free_remove(heap, next_ptr);
+		free_grow(heap, free_ptr, SECTION_SIZE(next_ptr));
+	};
+}
+#endif
 
-	//the previous link points to the new free section
-	(*link_ptr) = new_free;
+#if defined(MCHEAP_ENGINE_SEGREGATED) || defined(MCHEAP_ENGINE_TLSF)
+// Grow a free section which is in the free list by size bytes
+// As the section may change size class, it is removed and re-inserted
+static void free_grow(mcheap_t *heap, struct free_struct *free_ptr, size_t size)
+{
+	free_remove(heap, free_ptr);
+	ZERO_MERGE(free_ptr);
+	free_ptr->size += size;
+	TAG_NEXT(heap, free_ptr);
+	free_insert(heap, free_ptr);
 }
+#endif
 
-// Remove a free section from the free list
-// Walks the free list to find the link to modify
-static void free_remove(struct free_struct *free_ptr)
+// Return a section to the free list, and merge it with adjacent free sections
+// With boundary tags, if the section below is free it is grown to include the new section, so it need not be inserted.
+static void free_release(mcheap_t *heap, struct free_struct *free_ptr)
 {
-	struct free_struct **link_ptr;
-	link_ptr = &first_free;
+#if defined(MCHEAP_TRIM) && MCHEAP_TRIM_THRESHOLD
+	void* start = free_ptr;
+	void* end = SECTION_AFTER(free_ptr);
+#endif
+#ifdef BOUNDARY_TAGS
+	struct free_struct *below = find_free_below(heap, free_ptr);
 
-	// Find the link that points to this section
-	while(*link_ptr != free_ptr)
-		link_ptr = &(*link_ptr)->next_ptr;	//link_ptr == the address of the next link
+	if(below)
+	{
+		free_grow(heap, below, SECTION_SIZE(free_ptr));
+		free_merge_up(heap, below);
+		free_ptr = below;
+	}
+	else
+	{
+		free_insert(heap, free_ptr);
+		free_merge_up(heap, free_ptr);
+	};
+#else
+	free_insert(heap, free_ptr);	// insert it into the free list
+	free_ptr = free_merge(heap, free_ptr);	// and merge with adjacent free sections
+#endif
 
-	// Remove it
-	(*link_ptr) = free_ptr->next_ptr;
+#if defined(MCHEAP_TRIM) && MCHEAP_TRIM_THRESHOLD
+	free_trim_released(heap, free_ptr, start, end);
+#else
+	(void)free_ptr;
+#endif
 }
 
-// Merge free section with adjacent free sections
+#ifndef BOUNDARY_TAGS
+// Merge free section with adjacent free sections, and return the resulting section
 // All free sections must already be in the free list
-static void free_merge(struct free_struct *free_ptr)
+static struct free_struct* free_merge(mcheap_t *heap, struct free_struct *free_ptr)
 {
 	struct free_struct *below;
 
-	free_merge_up(free_ptr);
-	below = find_free_below(free_ptr);
+	free_merge_up(heap, free_ptr);
+	below = find_free_below(heap, free_ptr);
 	if(below)
-		free_merge_up(below);
+	{
+		free_merge_up(heap, below);
+		if((void*)SECTION_AFTER(below) > (void*)free_ptr)
+			free_ptr = below;
+	};
+
+	return free_ptr;
 }
+#endif
 
-// Merge free section into the next free section if possible
-static void free_merge_up(struct free_struct *free_ptr)
+// Return the total allocatable size of all free sections.
+// Walks every section of the heap, so that it works with any engine.
+static size_t free_find_total(mcheap_t *heap)
 {
-	//if there is a free section after this one
-	if(free_ptr->next_ptr)
+	void* section_ptr;
+	size_t total = 0;
+
+	section_ptr = heap->start;
+	while(section_ptr != END_OF_HEAP(heap))
 	{
-		//if the next free section is at the end of this free section
-		if(free_ptr->next_ptr == SECTION_AFTER(free_ptr))
+		if(in_free_list(heap, section_ptr))
 		{
-			//increase size of this free section, by total size of next section
-			free_ptr->size += SECTION_SIZE(free_ptr->next_ptr);
-
-			//copy next free sections link to this section
-			free_ptr->next_ptr = free_ptr->next_ptr->next_ptr;
-		};
+		//	convert to allocatable content size
+			total += SECTION_SIZE(FREECAST(section_ptr)) - sizeof(struct used_struct);
+			section_ptr += SECTION_SIZE(FREECAST(section_ptr));
+		}
+		else
+			section_ptr += SECTION_SIZE(USEDCAST(section_ptr));
 	};
+
+	return total;
 }
 
-// Find largest free block. Used for tracking heap headroom.
-static size_t free_find_largest(void)
+#ifdef MCHEAP_TRIM
+// Return the whole pages within the content of a free section to the operating system, return the number of bytes released
+// The free_struct header stays in place, so the section is still valid. The pages are given back by the operating system when they are next used.
+static size_t free_trim(mcheap_t *heap, struct free_struct *free_ptr)
 {
-	struct free_struct *free_ptr;
-	size_t largest=0;
-
-	if(!initialized)
-		initialize();
+	size_t page = page_align(1);
+	uintptr_t first = page_align((uintptr_t)free_ptr->content);
+	uintptr_t last = (uintptr_t)SECTION_AFTER(free_ptr) / page * page;
+	size_t retval = 0;
 
-	if(first_free)
+	if(first < last && madvise((void*)first, last - first, MCHEAP_TRIM_ADVICE) == 0)
 	{
-		free_ptr = first_free;
-		while(free_ptr)
+		retval = last - first;
+	#if defined(MCHEAP_TRACK_ZERO) && MCHEAP_TRIM_ADVICE == MADV_DONTNEED
+		// the released pages of a private anonymous mapping read back as zero, so only the partial pages at each end need clearing for the whole section to be zero
+		// a buffer given to mcheap_init() may be shared or file backed, in which case the pages read back with their old content
+		if(heap->anonymous)
 		{
-			if(free_ptr->size > largest)
-				largest = free_ptr->size;
-			free_ptr = free_ptr->next_ptr;
+			memset(free_ptr->content, 0, first - (uintptr_t)free_ptr->content);
+			memset((void*)last, 0, (uintptr_t)SECTION_AFTER(free_ptr) - last);
+			free_ptr->size |= FLAG_ZERO;
 		};
+	#endif
+	};
+	(void)heap;	// only used to track zero content
 
-	//	convert to allocatable content size
-		largest += sizeof(struct free_struct);
-		if(largest >= sizeof(struct used_struct))
-			largest -= sizeof(struct used_struct);
+	return retval;
+}
+
+// Trim every free section of the heap, return the number of bytes released
+static size_t heap_trim(mcheap_t *heap)
+{
+	uint8_t *section_ptr = heap->start;
+	size_t retval = 0;
+
+	while(section_ptr != END_OF_HEAP(heap))
+	{
+		if(USEDCAST(section_ptr)->size & FLAG_FREE)
+		{
+			retval += free_trim(heap, FREECAST(section_ptr));
+			section_ptr += SECTION_SIZE(FREECAST(section_ptr));
+		}
+		else
+			section_ptr += SECTION_SIZE(USEDCAST(section_ptr));
 	};
 
-	return largest;
+	return retval;
+}
+
+	#if MCHEAP_TRIM_THRESHOLD
+// Trim a free section which has just absorbed the released span from start to end, if it now has at least MCHEAP_TRIM_THRESHOLD bytes
+// The whole section is trimmed as it reaches the threshold. A part of it on either side of the span which had already reached the threshold
+// was trimmed then, so only the pages of the span are released, and the rest of the section is not advised again.
+static void free_trim_released(mcheap_t *heap, struct free_struct *free_ptr, void* start, void* end)
+{
+	size_t trimmed = sizeof(struct free_struct) + MCHEAP_TRIM_THRESHOLD;	// the smallest part which has reached the threshold
+	size_t page = page_align(1);
+	uintptr_t first, last;
+
+	if(CONTENT_SIZE(free_ptr) < MCHEAP_TRIM_THRESHOLD)
+		return;
+
+	if((size_t)((uint8_t*)start - (uint8_t*)free_ptr) < trimmed && (size_t)((uint8_t*)SECTION_AFTER(free_ptr) - (uint8_t*)end) < trimmed)
+		free_trim(heap, free_ptr);
+	else
+	{
+		// the zero flag is left as the merge set it, as pages which were zero still read back as zero once released
+		first = page_align(LARGEST_OF((uintptr_t)start, (uintptr_t)free_ptr->content));
+		last = (uintptr_t)end / page * page;
+		if(first < last)
+			madvise((void*)first, last - first, MCHEAP_TRIM_ADVICE);
+	};
 }
+	#endif
+#endif
 
 // Heap test, may be used before freeing memory, to see if the heap is intact,
-static bool heap_test(void)	
+static bool heap_test(mcheap_t *heap)	
 {
+#ifdef ENGINE_LIST
 	struct free_struct *next_free_ptr;
+#endif
 	void* section_ptr;
+#ifdef BOUNDARY_TAGS
+	void* below_ptr;
+#endif
 	bool intact = true;
 
-	if(!initialized)
-		initialize();
+#ifdef ENGINE_LIST
+	next_free_ptr = FIRST_FREE(heap);
+#endif
+	section_ptr = heap->start;
 
-	next_free_ptr = first_free;
-	section_ptr = heap_space;
-
-	while(intact && section_ptr != END_OF_HEAP)
+	while(intact && section_ptr != END_OF_HEAP(heap))
 	{
+#ifdef BOUNDARY_TAGS
+		below_ptr = section_ptr;
+#endif
+#ifdef ENGINE_LIST
+		// the free flag must agree with the free list
+		if(in_free_list(heap, section_ptr) != (section_ptr == (void*)next_free_ptr))
+			intact = false;
 		if(section_ptr == (void*)next_free_ptr)
 		{
-			next_free_ptr = FREECAST(section_ptr)->next_ptr;
+			next_free_ptr = NEXT_FREE(heap, FREECAST(section_ptr));
+#else
+		if(in_free_list(heap, section_ptr))
+		{
+#endif
 			section_ptr += SECTION_SIZE(FREECAST(section_ptr));
 		}
 		else
@@ -609,12 +4303,47 @@ static bool heap_test(void)
 		if((intptr_t)section_ptr % MCHEAP_ALIGNMENT)
 			intact = false;
 
-		if((uint8_t*)section_ptr < heap_space || (uint8_t*)section_ptr > END_OF_HEAP)
+		if((uint8_t*)section_ptr < heap->start || (uint8_t*)section_ptr > END_OF_HEAP(heap))
+			intact = false;
+
+#ifdef BOUNDARY_TAGS
+		// the boundary tag must match the size of the section below
+		if(intact && section_ptr != END_OF_HEAP(heap) && USEDCAST(section_ptr)->prev_size != (size_t)(section_ptr - below_ptr))
+			intact = false;
+		if(intact && section_ptr == END_OF_HEAP(heap) && heap->top_size != (size_t)(section_ptr - below_ptr))
 			intact = false;
+#endif
 	};
 	return intact;
 }
 
+#ifdef MCHEAP_THREAD_SAFE
+// Take the heap lock
+// Without lock hooks, a pthread mutex is used (a futex on Linux), unless MCHEAP_NO_PTHREAD is defined
+static void heap_lock(mcheap_t *heap)
+{
+	heap = heap->owner;
+	if(heap->lock_hook)
+		heap->lock_hook(heap->lock_arg);
+#ifndef MCHEAP_NO_PTHREAD
+	else
+		pthread_mutex_lock(&heap->default_mutex);
+#endif
+}
+
+// Release the heap lock
+static void heap_unlock(mcheap_t *heap)
+{
+	heap = heap->owner;
+	if(heap->unlock_hook)
+		heap->unlock_hook(heap->lock_arg);
+#ifndef MCHEAP_NO_PTHREAD
+	else
+		pthread_mutex_unlock(&heap->default_mutex);
+#endif
+}
+#endif
+
 // Ensure that size is aligned, AND that the used section will be large enough to return to the free list
 static size_t enforce_minimum_allocation_size(size_t sz)
 {
@@ -626,9 +4355,61 @@ static size_t enforce_minimum_allocation_size(size_t sz)
 	return sz;
 }
 
+#ifndef NDEBUG
+// A slab object must fit the size class of it's slab, and any other allocation must fit the content of it's section
+static bool size_fits(mcheap_t *heap, void* section, size_t size)
+{
+	bool retval = true;
+#ifdef MCHEAP_SLAB
+	struct slab_struct *slab = slab_of(heap, section);
+
+	if(slab)
+		retval = (size <= slab->object_size);
+	else
+#else
+	(void)heap;
+#endif
+	if(section)
+		retval = (size <= CONTENT_SIZE(container_of(section, struct used_struct, content)));
+
+	return retval;
+}
+#endif
+
 static size_t align_size(size_t sz)
 {
 	if(sz % MCHEAP_ALIGNMENT)
 		sz += MCHEAP_ALIGNMENT - (sz % MCHEAP_ALIGNMENT);
 	return sz;
 }
+
+static int address_compare(const void* a, const void* b)
+{
+	uintptr_t x = (uintptr_t)*(void* const*)a;
+	uintptr_t y = (uintptr_t)*(void* const*)b;
+
+	return (x > y) - (x < y);
+}
+
+#if defined(MCHEAP_GROWABLE) || defined(MCHEAP_TRIM) || defined(MCHEAP_MMAP_THRESHOLD)
+static size_t page_align(size_t sz)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	if(sz % page)
+		sz += page - (sz % page);
+	return sz;
+}
+#endif
+
+#if defined(MCHEAP_ENGINE_SEGREGATED) || defined(MCHEAP_ENGINE_TLSF)
+static int floor_log2(size_t x)
+{
+	return (int)(sizeof(unsigned long long)*CHAR_BIT - 1) - __builtin_clzll(x);
+}
+
+static int lowest_bit(size_t x)
+{
+	return __builtin_ctzll(x);
+}
+#endif
@@ -8,14 +8,180 @@ Configuration
  The following symbols may be defined to configure heap features:
 
 MCHEAP_SIZE
- 	The heap size in bytes. If this is not defined the default value of 1024 will be used.
+ 	The size in bytes of the default heap, which is used by the functions without a heap argument. If this is not defined the default value of 1024 will be used.
+	The control block of the heap is placed at the start of this space. Further heaps may be created at run time with mcheap_init().
 
 MCHEAP_ALIGNMENT
 	Ensure all allocations are aligned to the specified byte boundary.
 	If this is not defined, the default is __BIGGEST_ALIGNMENT__
 
+MCHEAP_ENGINE_SEGREGATED
+	Keep free sections in segregated lists, one for each power of 2 size class, instead of a single address ordered list.
+	A fitting free section is found from a bitmap of non-empty classes, instead of walking every free section.
+	Each class is kept in address order, so the lowest addressed section within a class is preferred.
+	Free and reallocate still search for adjacent free sections, so only allocation is made faster.
+
+MCHEAP_ENGINE_TLSF
+	Keep free sections in two level segregated fit (TLSF) lists, instead of a single address ordered list.
+	Sizes are divided into power of 2 ranges, each split into 2^MCHEAP_TLSF_SL_BITS linear steps, with a bitmap of non-empty lists.
+	Allocate, reallocate and free take a bounded time, independent of the number of free sections.
+	The only exception is an allocation which no rounded up size class can satisfy, which searches one list before failing.
+	Every section holds the size of the section below it, so that free sections may be merged without searching.
+	Placement no longer prefers the lowest address, so fragmentation may be higher than with the default engine.
+
+MCHEAP_TLSF_SL_BITS
+	The number of second level list bits for MCHEAP_ENGINE_TLSF, 1 to 5. If this is not defined the default of 3 (8 lists) is used.
+
+MCHEAP_ENGINE_TREE
+	Keep free sections in a balanced (AVL) tree ordered by address, instead of a single address ordered list.
+	Each node also holds the largest section size within it's subtree.
+	Allocation finds exactly the same lowest addressed fit as the default engine, so fragmentation is unchanged,
+	but allocation, insertion and removal of free sections take O(log n) time, for n free sections.
+	The free section meta data grows to hold the tree links, which raises the minimum allocation size.
+
+MCHEAP_BOUNDARY_TAGS
+	Every section holds the size of the section below it, so the section below any section can be found without searching the free list.
+	This makes merging on free and reallocate take constant time, with any engine.
+	With the default engine, a section freed directly above a free section is merged without walking the free list.
+	The cost is one size_t per section, which may be absorbed by padding when MCHEAP_ALIGNMENT is larger than a size_t.
+	MCHEAP_ENGINE_TLSF always uses boundary tags.
+
+MCHEAP_SLAB
+	Serve small allocations from slabs, instead of giving each one it's own section of the heap.
+	A slab is a section of MCHEAP_SLAB_SIZE bytes allocated from the heap, which is divided into objects of a single size class.
+	There is one size class for each multiple of MCHEAP_ALIGNMENT up to MCHEAP_SLAB_MAX.
+	Allocating and freeing an object takes constant time, and objects have no per allocation meta data.
+	A slab is returned to the heap as soon as all of it's objects are freed.
+	If no slab can be allocated, small allocations are made from the heap as usual.
+	Reallocating an object to a size which still fits it's class does not move it. Shrinking an object never releases any space.
+	MCHEAP_ALIGNMENT must be a multiple of the pointer size.
+
+MCHEAP_SLAB_SIZE
+	The size of each slab in bytes, including it's meta data. Must be a multiple of MCHEAP_ALIGNMENT. If this is not defined the default of 512 is used.
+
+MCHEAP_SLAB_MAX
+	The largest allocation served by slabs. Must be a multiple of MCHEAP_ALIGNMENT. If this is not defined the default of 128 is used.
+
+MCHEAP_PLACEMENT
+	The initial placement policy, one of MCHEAP_FIRST_FIT, MCHEAP_NEXT_FIT, MCHEAP_BEST_FIT or MCHEAP_WORST_FIT.
+	If this is not defined the default of MCHEAP_FIRST_FIT is used. The policy may also be changed at run time with mcheap_set_placement().
+	Only the default engine supports placement policies, the other engines have their own fixed placement, and mcheap_set_placement() returns false for every policy.
+	MCHEAP_FIRST_FIT  Use the lowest addressed section which fits. This favors defragmentation.
+	MCHEAP_NEXT_FIT   Use the first section which fits, searching on from where the last search ended. Spreads allocations across the heap.
+	MCHEAP_BEST_FIT   Use the smallest section which fits, the lowest addressed if there are several. Walks the whole free list unless an exact fit is found.
+	MCHEAP_WORST_FIT  Use the largest section. Always walks the whole free list.
+
+MCHEAP_COPY_BUDGET
+	The most bytes of content which reallocate will copy, to move a section to a lower address when it could be resized in place.
+	Larger sections are left where they are, so shrinking a large buffer slightly doesn't copy all of it, while small sections still move down to reduce fragmentation.
+	A section which can't be resized in place is always moved. If this is not defined the default of 65536 is used, define as SIZE_MAX for no limit.
+	The budget may also be changed at run time with mcheap_set_copy_budget().
+
+MCHEAP_COPY_RATIO
+	The most bytes of content which reallocate will copy for each byte that a section which could be resized in place moves down.
+	The distance moved is the free space closed up below the section, so a section isn't copied to gain only a little space, such as a small free section below it.
+	If this is not defined the default of 8 is used. A section is only moved if both the budget and the ratio allow it.
+
+MCHEAP_THREAD_SAFE
+	Allow the heap to be used by several threads. Every function holds a lock while it uses the heap.
+	The lock is a pthread mutex, unless other lock functions are provided with mcheap_set_lock_hooks(), for example to use an RTOS mutex or to disable interrupts.
+	The lock is released while a reallocation copies content to a new section, so other threads are not held up by large copies.
+
+MCHEAP_NO_PTHREAD
+	With MCHEAP_THREAD_SAFE, don't provide the default pthread lock. mcheap_set_lock_hooks() must be called before the heap is used by more than one thread.
+
+MCHEAP_THREAD_CACHE
+	Give each thread a cache of the allocations it has freed, so that most small allocations and frees don't take the heap lock.
+	The cache is binned by content size, for each multiple of MCHEAP_ALIGNMENT up to MCHEAP_THREAD_CACHE_MAX.
+	An empty bin is refilled from the heap, and a full bin is partly flushed to the heap, in batches of half of MCHEAP_THREAD_CACHE_COUNT under a single lock.
+	Allocations held in a cache are still used sections of the heap, so they are not included in mcheap_largest_free() or mcheap_total_free().
+	If the heap can't satisfy an allocation, the calling threads cache is flushed and the allocation is tried again.
+	A threads cache is flushed when the thread exits, or when it calls mcheap_flush_cache(). mcheap_reinit() discards the caches of all threads.
+	A threads cache holds allocations from one heap at a time, and is flushed when the thread uses a different heap instance.
+	Requires MCHEAP_THREAD_SAFE, and can't be used with MCHEAP_SLAB. MCHEAP_ALIGNMENT must be a multiple of the pointer size.
+	With MCHEAP_NO_PTHREAD, caches are not flushed on thread exit, so threads should call mcheap_flush_cache() before they exit.
+
+MCHEAP_THREAD_CACHE_MAX
+	The largest allocation content size held in thread caches. Must be a multiple of MCHEAP_ALIGNMENT. If this is not defined the default of 256 is used.
+
+MCHEAP_THREAD_CACHE_COUNT
+	The most allocations held in each bin of a thread cache. If this is not defined the default of 16 is used.
+
+MCHEAP_THREAD_CACHE_BYTES
+	The most content bytes held in each thread cache. If this is not defined the default of MCHEAP_SIZE/16 is used.
+
+MCHEAP_GROWABLE
+	Place the default heap in reserved virtual address space (POSIX mmap), instead of a static array, and commit memory to it only as it is needed.
+	MCHEAP_SIZE becomes the size of the reserved space, which is the most the heap can grow to.
+	The heap starts with MCHEAP_GROW_SIZE bytes. When no free section can satisfy an allocation, more of the reserved space is committed to the top of the heap.
+	This keeps startup fast and the resident memory small for a typical load, while keeping the worst case capacity.
+	Further growable heaps may be created with mcheap_reserve(). Can't be used with MCHEAP_ADDRESS.
+
+MCHEAP_GROW_SIZE
+	The least number of bytes committed to a growable heap at once, rounded up to whole pages. If this is not defined the default of 65536 is used.
+
+MCHEAP_TRIM
+	Return the memory of large free sections to the operating system (POSIX madvise), so that the resident memory shrinks after a peak.
+	Only the whole pages within the content of a free section are released, the free section meta data is not disturbed.
+	The pages are given back by the operating system when they are next used. With MADV_DONTNEED they are zero filled only for private anonymous memory,
+	such as a mcheap_reserve() heap. A shared or file backed buffer, or an initialized one, reads back with it's old content.
+	mcheap_trim() releases the pages of every free section on demand, and returns the number of bytes released.
+	A free section is also trimmed automatically when a free or merge takes it to at least MCHEAP_TRIM_THRESHOLD bytes. Once it has reached the threshold,
+	only the pages of sections which are later freed into it are released, as the rest were released then. A free section which never reached
+	the threshold by a free or merge, such as the initial section of a mcheap_init() heap, is only trimmed by mcheap_trim().
+
+MCHEAP_TRIM_THRESHOLD
+	The free section size which is trimmed automatically. Define as 0 to only trim with mcheap_trim(). If this is not defined the default of 131072 is used.
+	Each free or merge which releases whole pages into a section above the threshold makes a system call, so it should not be too small.
+
+MCHEAP_TRIM_ADVICE
+	The advice given to madvise(). If this is not defined the default of MADV_DONTNEED is used.
+	MADV_FREE is cheaper, but the pages stay resident until the system is short of memory.
+
+MCHEAP_MMAP_THRESHOLD
+	Give each allocation of at least this many bytes it's own mapping (POSIX mmap), instead of a section of the heap, so that huge allocations don't fragment the heap.
+	Reallocating such an allocation resizes it's mapping with mremap() (Linux), which moves pages instead of copying the content.
+	An allocation which is reallocated below the threshold moves back into the heap if it fits, and a section reallocated to the threshold moves to it's own mapping.
+	Freeing it unmaps it. Mapped allocations are not included in mcheap_largest_free(), mcheap_total_free() or mcheap_is_intact().
+	If this is not defined, all allocations are made from the heap. MCHEAP_ALIGNMENT must be at least 4.
+
+MCHEAP_TRACK_ZERO
+	Flag free sections whose content is known to be zero, so that mcheap_allocate_zeroed() only clears the part of an allocation which may have been used.
+	Memory is known to be zero in the default heap (unless MCHEAP_ADDRESS is defined) and in mcheap_reserve() heaps until it is first used,
+	and in free sections of mcheap_reserve() heaps trimmed with the default MCHEAP_TRIM_ADVICE. Trimmed sections of other heaps are not taken to be zero,
+	as their buffer may not be private anonymous memory. A section which is merged with a section that is not zero is no longer zero.
+	If this is not defined, mcheap_allocate_zeroed() always clears the whole allocation. MCHEAP_ALIGNMENT must be at least 8.
+
+MCHEAP_HANDLES
+	Provide movable allocations, which are made with mcheap_handle_allocate() and addressed through a handle.
+	An allocation is only accessed between mcheap_handle_lock() and mcheap_handle_unlock(), and mcheap_compact() may move it to a lower address while it is not locked.
+	An allocation made with mcheap_allocate() may also be moved, once it is registered with mcheap_register(), which takes a function to call when it moves.
+	If every allocation is movable and none are locked, compacting the heap leaves all of the free space in one section at the top.
+	If this is not defined, mcheap_handle_allocate() and mcheap_register() always return NULL, and mcheap_compact() and mcheap_defrag_step() do nothing.
+
+MCHEAP_HANDLE_COUNT
+	The number of handles of each heap. If this is not defined the default of 16 is used. An unused handle is found by a linear search,
+	but the used handles are linked in order of address, so each step of mcheap_compact() or mcheap_defrag_step() takes the next in constant time.
+	The handles are held in the control block of each heap instance. A region added to a heap with mcheap_add_region() has none of it's own.
+
+MCHEAP_AUTO_DEFRAG
+	When mcheap_allocate() fails, continue the incremental defragmentation as mcheap_defrag_step() does, and try again if anything was moved.
+	The step stops once a free section is large enough for the allocation, or MCHEAP_AUTO_DEFRAG_BUDGET bytes have been moved. Requires MCHEAP_HANDLES.
+	Any allocation may then move registered allocations, so they must not be used by other threads while they are not locked.
+
+MCHEAP_AUTO_DEFRAG_BUDGET
+	The most bytes a failed allocation moves before it gives up, which bounds the time it holds the heap lock. Allocations larger than this are not moved by it.
+	If this is not defined the default of 16384 is used.
+
+MCHEAP_COMPACT_HEADERS
+	Use the smallest size fields in each section which can hold MCHEAP_SIZE, 16 bits up to 65535 (32767 if MCHEAP_ALIGNMENT is 1), or 32 bits up to 4G (2G).
+	With the default engine, free sections are also linked by their offset from the start of the heap, instead of by pointers.
+	A heap instance or region which is too large for the size fields is refused by mcheap_init() or mcheap_add_region().
+	The headers are padded to MCHEAP_ALIGNMENT, so this only saves memory if MCHEAP_ALIGNMENT is smaller than a size_t. Can't be used with MCHEAP_MMAP_THRESHOLD.
+
 MCHEAP_ADDRESS
 	Specify a fixed memory address for the heap. This is useful for parts which may have external RAM not covered by the linker script.
+	Further memory may be added to the heap at run time with mcheap_add_region().
  	If this is not defined, the heap space will simply be a static uint8_t[] within the BSS section.
  	**CAUTION** If this is used, the address provided MUST respect the MCHEAP_ALIGNMENT provided, or an alignment of __BIGGEST_ALIGNMENT__
 
@@ -31,6 +197,27 @@ MCHEAP_ADDRESS
 // Public defines
 //********************************************************************************************************
 
+//	Placement policies, see MCHEAP_PLACEMENT
+	typedef enum
+	{
+		MCHEAP_FIRST_FIT,
+		MCHEAP_NEXT_FIT,
+		MCHEAP_BEST_FIT,
+		MCHEAP_WORST_FIT
+	} mcheap_placement_t;
+
+//	Lock hook, see MCHEAP_THREAD_SAFE
+	typedef void (*mcheap_lock_hook_t)(void* arg);
+
+//	A heap instance, see mcheap_init()
+	typedef struct mcheap_struct mcheap_t;
+
+//	A movable allocation, see MCHEAP_HANDLES
+	typedef struct mcheap_handle_struct* mcheap_handle_t;
+
+//	Called when a registered allocation is moved, see mcheap_register()
+	typedef void (*mcheap_move_hook_t)(void* old_ptr, void* new_ptr, void* arg);
+
 //********************************************************************************************************
 // Public variables
 //********************************************************************************************************
@@ -50,20 +237,178 @@ MCHEAP_ADDRESS
 		* extend down (or shift down if new size is smaller)
 		* shrink in place
 		* extend up
+		* extend both down and up, shifting the content down
 		* relocate to a higher address.
+	The first two are skipped if the section can be resized in place, and the copy isn't worth the space gained, see MCHEAP_COPY_BUDGET and MCHEAP_COPY_RATIO.
 	If heap_reallocate() fails, it will return NULL.*/
 	void*	mcheap_reallocate(void* ptr, size_t size);
 
+/*	Reallocate as above, but if the allocation is moved, only the first preserve_size bytes of it's content are kept.
+	The rest of the content is undefined. A preserve_size of 0 keeps nothing, for a buffer which is about to be overwritten.
+	Passing a preserve_size of size or more is the same as mcheap_reallocate().*/
+	void*	mcheap_reallocate_ex(void* ptr, size_t size, size_t preserve_size);
+
 //	Free the allocation, always returns NULL
 	void*	mcheap_free(void* ptr);
 
+/*	Resize an allocation to size bytes without moving it, by shrinking it or extending it up into the free section after it.
+	Returns true on success. On failure, or if ptr is NULL or size is 0, the allocation is unchanged and false is returned.*/
+	bool	mcheap_try_resize(void* ptr, size_t size);
+
+/*	Return the number of bytes which may be used in an allocation, which is at least the size it was allocated with.
+	All of them may be used without reallocating. Returns 0 if ptr is NULL.*/
+	size_t	mcheap_usable_size(void* ptr);
+
+/*	Free an allocation, or reallocate it to new_size bytes, given the size it was allocated or last reallocated with.
+	The size is used in place of the size held by the allocation where possible. An allocation larger than MCHEAP_SLAB_MAX
+	is not looked for in the slab layer, and the thread cache bin is chosen without reading the allocation.
+	Unless NDEBUG is defined, the size is checked against the allocation with assert().*/
+	void*	mcheap_free_sized(void* ptr, size_t size);
+	void*	mcheap_reallocate_sized(void* ptr, size_t size, size_t new_size);
+
+/*	Allocate count blocks of memory, of sizes[0] to sizes[count-1] bytes, and store their addresses in ptrs[0] to ptrs[count-1].
+	The blocks are carved consecutively from one free section if there is one large enough, otherwise they are allocated separately.
+	Returns true on success. On failure nothing is allocated, ptrs[] is filled with NULL and false is returned.
+	Batch allocations are always made from the heap, never from the slab layer or the thread cache. Each block may be freed or reallocated on it's own.*/
+	bool	mcheap_allocate_batch(const size_t *sizes, void** ptrs, size_t count);
+
+/*	Free count allocations, in any order. NULL pointers are ignored.
+	The pointers are sorted by address, and adjacent allocations are merged before they are returned to the free list together,
+	with a single walk of the free list for the default engine. ptrs[] is used as working space, so it's contents are lost.*/
+	void	mcheap_free_batch(void** ptrs, size_t count);
+
+/*	Allocate memory with the content cleared to zero, and return it's address, or NULL on failure.
+	Only the part of the allocation which may have been used is cleared, see MCHEAP_TRACK_ZERO.
+	Zeroed allocations are always made from the heap, never from the slab layer or the thread cache.*/
+	void*	mcheap_allocate_zeroed(size_t size);
+
+/*	Allocate memory with it's address a multiple of align, or return NULL on failure.
+	align must be a power of 2, and either a multiple or a factor of MCHEAP_ALIGNMENT, otherwise NULL is returned.
+	The padding needed below the allocation is returned to the heap as a free section, so only an align of less than
+	the size of a free section's meta data costs more than align bytes. Aligned allocations are never given their own mapping.
+	The allocation is freed with mcheap_free() as usual.*/
+	void*	mcheap_allocate_aligned(size_t size, size_t align);
+
+/*	Reallocate the memory at *ptr to be a new size, with it's address a multiple of align.
+	An allocation which is already aligned is shrunk in place or extended up if possible, otherwise it is moved.
+	If ptr is NULL or size is 0, this behaves as mcheap_allocate_aligned() or mcheap_free().
+	Note that mcheap_reallocate() may move an aligned allocation to an address which is not aligned.*/
+	void*	mcheap_reallocate_aligned(void* ptr, size_t size, size_t align);
+
+//	Allocate a movable block of memory of size bytes, see MCHEAP_HANDLES.
+//	Returns NULL if the allocation fails, if all handles are in use, or if MCHEAP_HANDLES is not defined.
+	mcheap_handle_t	mcheap_handle_allocate(size_t size);
+
+/*	Lock a handle and return the address of it's allocation, which is not moved until the handle is unlocked.
+	Locks nest, a handle locked twice must be unlocked twice. The address may change each time the handle is locked.*/
+	void*	mcheap_handle_lock(mcheap_handle_t handle);
+	void	mcheap_handle_unlock(mcheap_handle_t handle);
+
+//	Free a movable allocation and it's handle, which may be locked.
+	void	mcheap_handle_free(mcheap_handle_t handle);
+
+/*	Move unlocked movable allocations to lower addresses, merging the free space between them, and return the number of bytes copied.
+	Allocations are visited in order of address, and each is only moved if it's size is within what is left of budget bytes.
+	The heap is locked while an allocation is copied. Unlike reallocation, other threads are held up by large copies.*/
+	size_t	mcheap_compact(size_t budget);
+
+/*	Register an allocation made with mcheap_allocate() as movable, see MCHEAP_HANDLES, and return it's handle.
+	hook is called with arg after the allocation is moved, so that the owner can update it's pointer. The heap is locked during the call,
+	so the hook must not call any other mcheap function. The handle may be locked to stop the allocation moving while it is in use.
+	Returns NULL if all handles are in use, or if the allocation can't be moved (a slab object, or an allocation with it's own mapping).
+	The allocation must be unregistered before it is freed or reallocated, or be freed with mcheap_handle_free().*/
+	mcheap_handle_t	mcheap_register(void* ptr, mcheap_move_hook_t hook, void* arg);
+
+//	Release the handle of a registered allocation, which is not freed, and won't be moved again.
+	void	mcheap_unregister(mcheap_handle_t handle);
+
+/*	Move unlocked movable allocations to lower addresses as mcheap_compact() does, but continue from where the previous step ended,
+	and return once max_bytes have been copied. The heap is compacted a little at a time by calling this repeatedly, for example when idle.*/
+	size_t	mcheap_defrag_step(size_t max_bytes);
+
+//	Return all allocations held in the calling threads cache to the heap, see MCHEAP_THREAD_CACHE.
+//	Does nothing unless MCHEAP_THREAD_CACHE is defined.
+	void	mcheap_flush_cache(void);
+
 //	Return largest possible allocation that can currently be made.
 	size_t  mcheap_largest_free(void);
 
+//	Return the total of the largest allocations that could be made from each free section.
+//	Together with mcheap_largest_free() this measures fragmentation.
+	size_t  mcheap_total_free(void);
+
+//	Select the placement policy used by allocate and reallocate, see MCHEAP_PLACEMENT.
+//	Returns false if the policy is not supported by the engine, in which case the placement is unchanged.
+	bool	mcheap_set_placement(mcheap_placement_t placement);
+
+//	Set the most bytes reallocate will copy to move a section which could be resized in place, see MCHEAP_COPY_BUDGET.
+//	Returns the previous budget.
+	size_t	mcheap_set_copy_budget(size_t budget);
+
+//	Set the functions used to take and release the heap lock, both are passed arg.
+//	Pass NULL for both to return to the default lock. This must not be called while other threads may be using the heap.
+//	Does nothing unless MCHEAP_THREAD_SAFE is defined.
+	void	mcheap_set_lock_hooks(mcheap_lock_hook_t lock, mcheap_lock_hook_t unlock, void* arg);
+
 //	Return true if all the heap meta data is valid and intact.
 	bool	mcheap_is_intact(void);
 
 //	If the heap is broken, this can re-initialize it.
 //	This is used after test cases which break the heap on purpose.
 	void	mcheap_reinit(void);
+
+/*	Add a region of memory in a buffer of size bytes to the heap, with a priority. Returns false if the buffer is too small.
+	The heap initially has one region of priority 0. Allocations are made from the region with the highest priority which has space,
+	so fast memory should be given a higher priority than slow memory. Regions of the same priority are used in the order they were added.
+	A reallocation which doesn't fit in it's own region is moved to any region with space.
+	Each region has it's own control block, and allocations never span regions, even if the buffers are adjacent.
+	A region can't be removed, and the buffer must not overlap any other region.*/
+	bool	mcheap_add_region(void* buffer, size_t size, int priority);
+
+//	Return the whole pages within free sections to the operating system, and return the number of bytes released, see MCHEAP_TRIM.
+//	Returns 0 unless MCHEAP_TRIM is defined.
+	size_t	mcheap_trim(void);
+
+/*	Create a heap instance in a buffer of size bytes, and return it's handle, or NULL if the buffer is too small.
+	The control block of the heap is placed at the start of the buffer, the rest is available for allocations.
+	Each instance is independent of the default heap used by the functions above, and of every other instance.
+	The configuration (engine, alignment, etc.) is the same for all instances, only the size is chosen at run time.
+	The buffer must not be used by anything else while the heap exists. A heap needs no cleanup, the buffer may simply be reused.*/
+	mcheap_t*	mcheap_init(void* buffer, size_t size);
+
+/*	Create a heap instance which may grow to size bytes, in newly reserved address space, see MCHEAP_GROWABLE.
+	Returns NULL if the space can't be reserved, or if MCHEAP_GROWABLE is not defined.*/
+	mcheap_t*	mcheap_reserve(size_t size);
+
+//	The functions above, for a heap instance created by mcheap_init()
+	void*	mcheap_heap_allocate(mcheap_t *heap, size_t size);
+	void*	mcheap_heap_reallocate(mcheap_t *heap, void* ptr, size_t size);
+	void*	mcheap_heap_reallocate_ex(mcheap_t *heap, void* ptr, size_t size, size_t preserve_size);
+	void*	mcheap_heap_free(mcheap_t *heap, void* ptr);
+	bool	mcheap_heap_try_resize(mcheap_t *heap, void* ptr, size_t size);
+	size_t	mcheap_heap_usable_size(mcheap_t *heap, void* ptr);
+	void*	mcheap_heap_free_sized(mcheap_t *heap, void* ptr, size_t size);
+	void*	mcheap_heap_reallocate_sized(mcheap_t *heap, void* ptr, size_t size, size_t new_size);
+	bool	mcheap_heap_allocate_batch(mcheap_t *heap, const size_t *sizes, void** ptrs, size_t count);
+	void	mcheap_heap_free_batch(mcheap_t *heap, void** ptrs, size_t count);
+	void*	mcheap_heap_allocate_zeroed(mcheap_t *heap, size_t size);
+	void*	mcheap_heap_allocate_aligned(mcheap_t *heap, size_t size, size_t align);
+	void*	mcheap_heap_reallocate_aligned(mcheap_t *heap, void* ptr, size_t size, size_t align);
+	mcheap_handle_t	mcheap_heap_handle_allocate(mcheap_t *heap, size_t size);
+	void*	mcheap_heap_handle_lock(mcheap_t *heap, mcheap_handle_t handle);
+	void	mcheap_heap_handle_unlock(mcheap_t *heap, mcheap_handle_t handle);
+	void	mcheap_heap_handle_free(mcheap_t *heap, mcheap_handle_t handle);
+	size_t	mcheap_heap_compact(mcheap_t *heap, size_t budget);
+	mcheap_handle_t	mcheap_heap_register(mcheap_t *heap, void* ptr, mcheap_move_hook_t hook, void* arg);
+	void	mcheap_heap_unregister(mcheap_t *heap, mcheap_handle_t handle);
+	size_t	mcheap_heap_defrag_step(mcheap_t *heap, size_t max_bytes);
+	size_t  mcheap_heap_largest_free(mcheap_t *heap);
+	size_t  mcheap_heap_total_free(mcheap_t *heap);
+	bool	mcheap_heap_set_placement(mcheap_t *heap, mcheap_placement_t placement);
+	size_t	mcheap_heap_set_copy_budget(mcheap_t *heap, size_t budget);
+	void	mcheap_heap_set_lock_hooks(mcheap_t *heap, mcheap_lock_hook_t lock, mcheap_lock_hook_t unlock, void* arg);
+	bool	mcheap_heap_is_intact(mcheap_t *heap);
+	void	mcheap_heap_reinit(mcheap_t *heap);
+	bool	mcheap_heap_add_region(mcheap_t *heap, void* buffer, size_t size, int priority);
+	size_t	mcheap_heap_trim(mcheap_t *heap);
 #endif
\ No newline at end of file
@@ -9,9 +9,22 @@
 	#include <stdint.h>
 	#include <inttypes.h>
 	#include <math.h>
+	#include <time.h>
 	#include "../mcheap.h"
 	#include "greatest.h"
 
+	#if defined(__x86_64__) || defined(__i386__)
+		#include <x86intrin.h>
+	#endif
+
+	#ifdef MCHEAP_THREAD_SAFE
+		#include <pthread.h>
+	#endif
+
+	#ifdef MCHEAP_TRIM
+		#include <sys/mman.h>
+	#endif
+
 
 //********************************************************************************************************
 // Configurable defines
@@ -20,6 +33,53 @@
 	#define ALLOCATION_COUNT 8
 	#define RANDOM_OP_COUNT 1000000
 
+	#define SMALL_ALLOCATION_COUNT 24
+	#define SMALL_MAX_SIZE 128
+
+	#define INSTANCE_SIZE 2048
+	#define REGION_ALLOCATION_COUNT 32
+	#define REGION_ALLOCATION_SIZE 300
+
+	#define RESERVE_SIZE (64*1024*1024)
+
+	#define TRIM_BUFFER_SIZE (1024*1024)
+
+	#define MAPPED_SIZE (1024*1024)
+
+	#define ALIGNED_BUFFER_SIZE (16*1024)
+
+#if defined(MCHEAP_COMPACT_HEADERS) && MCHEAP_SIZE <= 0xFFFF
+//	section sizes may be 16 bits, which can't address more than 64K
+	#define ZEROED_BUFFER_SIZE (16*1024)
+	#define ZEROED_MAX_SIZE 256
+	#define ZEROED_LARGE_SIZE (8*1024)
+#else
+	#define ZEROED_BUFFER_SIZE (1024*1024)
+	#define ZEROED_MAX_SIZE 4096
+	#define ZEROED_LARGE_SIZE (512*1024)
+#endif
+	#define ZEROED_ALLOCATION_COUNT 16
+	#define ZEROED_ROUND_COUNT 64
+
+	#define BATCH_BUFFER_SIZE (16*1024)
+	#define BATCH_COUNT 64
+	#define BATCH_MAX_SIZE 64
+
+	#define RESIZE_SIZE 300
+
+	#define HANDLE_TEST_COUNT 12
+
+	#define COMPACT_BUFFER_SIZE (16*1024)
+
+	#define THREAD_COUNT 4
+	#define THREAD_ALLOCATION_COUNT 4
+	#define THREAD_OP_COUNT 200000
+	#define THREAD_MAX_SIZE (MCHEAP_SIZE/(THREAD_COUNT*THREAD_ALLOCATION_COUNT*2))
+
+	#define LATENCY_ALLOCATION_COUNT 64
+	#define LATENCY_OP_COUNT 200000
+	#define LATENCY_WARMUP_COUNT 20000
+
 //********************************************************************************************************
 // Local defines
 //********************************************************************************************************
@@ -27,8 +87,53 @@
 	#define ERR_REALLOC_BROKE_ON_INCREASE -1
 	#define ERR_REALLOC_BROKE_ON_DECREASE -2
 
+	#define SMALLEST_OF(x,y) ((x)<(y) ? (x):(y))
+
+//	true if ptr addresses an element of the array buf
+	#define IN_BUFFER(ptr, buf)	((uint8_t*)(ptr) >= (buf) && (uint8_t*)(ptr) < &(buf)[sizeof(buf)])
+
 	#define DBG(_fmtarg, ...) printf("%s:%.4i - "_fmtarg"\n" , __FILE__, __LINE__ ,##__VA_ARGS__)
 
+	#if defined(MCHEAP_ENGINE_SEGREGATED)
+		#define ENGINE_NAME "segregated"
+		#define ENGINE_PLACEMENT "segregated-fit"
+	#elif defined(MCHEAP_ENGINE_TLSF)
+		#define ENGINE_NAME "tlsf"
+		#define ENGINE_PLACEMENT "good-fit"
+	#elif defined(MCHEAP_ENGINE_TREE)
+		#define ENGINE_NAME "tree"
+		#define ENGINE_PLACEMENT "address-ordered-fit"
+	#else
+		#define ENGINE_NAME "list"
+		#define ENGINE_PLACEMENT "first-fit"
+	#endif
+
+//	read a cycle counter, or a nanosecond clock where there is no cycle counter
+	#if defined(__x86_64__) || defined(__i386__)
+		#define CYCLES_FROM_RDTSC
+		#define CYCLES()	((uint64_t)__rdtsc())
+		#define CYCLES_UNIT	"cycles"
+	#else
+		#define CYCLES()	clock_ns()
+		#define CYCLES_UNIT	"ns"
+	#endif
+
+//	tests which depend on where small allocations are placed in the heap can't be run with the slab layer or thread caches
+	#if defined(MCHEAP_SLAB)
+		#define SKIP_WITH_FRONT_END()	SKIPm("small allocations are served by slabs")
+	#elif defined(MCHEAP_THREAD_CACHE)
+		#define SKIP_WITH_FRONT_END()	SKIPm("small allocations are served by thread caches")
+	#else
+		#define SKIP_WITH_FRONT_END()
+	#endif
+
+//	tests which expect every allocation that fits in the heap to be made from it can't be run with a mapping threshold below the heap size
+	#if defined(MCHEAP_MMAP_THRESHOLD) && MCHEAP_MMAP_THRESHOLD < MCHEAP_SIZE
+		#define SKIP_WITH_LOW_MMAP_THRESHOLD()	SKIPm("allocations above MCHEAP_MMAP_THRESHOLD are given their own mapping")
+	#else
+		#define SKIP_WITH_LOW_MMAP_THRESHOLD()
+	#endif
+
 	GREATEST_MAIN_DEFS();
 
 //********************************************************************************************************
@@ -45,6 +150,9 @@
 	static uint32_t count_realloc_same = 0;
 	static uint32_t count_allocate = 0;
 	static uint32_t count_free = 0;
+	static uint64_t random_heap_time = 0;	// time spent within mcheap calls by test_random
+
+	static const char* placement_names[] = {"first-fit", "next-fit", "best-fit", "worst-fit"};
 
 	static uint8_t buffers[ALLOCATION_COUNT][MCHEAP_SIZE];
 
@@ -57,17 +165,43 @@
 	TEST test_realloc_shrink_in_place(void);
 	TEST test_realloc_ext_down(void);
 	TEST test_realloc_ext_up(void);
+	TEST test_realloc_ext_both(void);
 	TEST test_realloc_higher(void);
+	TEST test_realloc_preserve(void);
+	TEST test_realloc_copy_budget(void);
 
 	SUITE(suite_other);
 	TEST test_alloc_fail(void);
 	TEST test_max_free(void);
 	TEST test_intact(void);
-	TEST test_random(void);
+	TEST test_small(void);
+	TEST test_instances(void);
+	TEST test_regions(void);
+	TEST test_reserve(void);
+	TEST test_trim(void);
+	TEST test_mapped(void);
+	TEST test_aligned(void);
+	TEST test_zeroed(void);
+	TEST test_batch(void);
+	TEST test_sized(void);
+	TEST test_resize(void);
+	TEST test_handles(void);
+	TEST test_defrag(void);
+	TEST test_compact_headers(void);
+	TEST test_random(mcheap_placement_t placement);
+	TEST test_threads(void);
+	TEST test_latency(void);
 
 	static int random_realloc(char **ptr_ptr, int *size_ptr, uint8_t buf[MCHEAP_SIZE]);
 	static void clutter(char* dst, size_t sz);
+	static bool is_filled(char* ptr, char value, size_t sz);
+	static void move_hook(void* old_ptr, void* new_ptr, void* arg);
+	#ifdef MCHEAP_THREAD_SAFE
+	static void* thread_random(void* arg);
+	#endif
 	int choose_allocation_size(void);
+	static uint64_t clock_ns(void);
+	static double fragmentation(void);
 
 //********************************************************************************************************
 // Public functions
@@ -93,7 +227,10 @@ SUITE(suite_realloc)
 	RUN_TEST(test_realloc_shrink_in_place);
 	RUN_TEST(test_realloc_ext_down);
 	RUN_TEST(test_realloc_ext_up);
+	RUN_TEST(test_realloc_ext_both);
 	RUN_TEST(test_realloc_higher);
+	RUN_TEST(test_realloc_preserve);
+	RUN_TEST(test_realloc_copy_budget);
 }
 
 SUITE(suite_other)
@@ -101,11 +238,34 @@ SUITE(suite_other)
 	RUN_TEST(test_alloc_fail);
 	RUN_TEST(test_max_free);
 	RUN_TEST(test_intact);
-	RUN_TEST(test_random);
+	RUN_TEST(test_small);
+	RUN_TEST(test_instances);
+	RUN_TEST(test_regions);
+	RUN_TEST(test_reserve);
+	RUN_TEST(test_trim);
+	RUN_TEST(test_mapped);
+	RUN_TEST(test_aligned);
+	RUN_TEST(test_zeroed);
+	RUN_TEST(test_batch);
+	RUN_TEST(test_sized);
+	RUN_TEST(test_resize);
+	RUN_TEST(test_handles);
+	RUN_TEST(test_defrag);
+	RUN_TEST(test_compact_headers);
+	RUN_TEST1(test_random, MCHEAP_FIRST_FIT);
+	RUN_TEST1(test_random, MCHEAP_NEXT_FIT);
+	RUN_TEST1(test_random, MCHEAP_BEST_FIT);
+	RUN_TEST1(test_random, MCHEAP_WORST_FIT);
+	RUN_TEST(test_threads);
+	RUN_TEST(test_latency);
 }
 
 TEST test_realloc_lower(void)
 {
+#ifdef MCHEAP_ENGINE_TLSF
+	SKIPm("TLSF does not prefer the lowest addressed fit");
+#endif
+	SKIP_WITH_FRONT_END();
 	mcheap_reinit();
 	char *a = mcheap_allocate(100);
 			  mcheap_allocate(20);
@@ -123,6 +283,7 @@ TEST test_realloc_lower(void)
 
 TEST test_realloc_shrink_in_place(void)
 {
+	SKIP_WITH_FRONT_END();
 	mcheap_reinit();
 	char *a = mcheap_allocate(50);
 			  mcheap_allocate(20);
@@ -139,6 +300,7 @@ TEST test_realloc_shrink_in_place(void)
 
 TEST test_realloc_ext_down(void)
 {
+	SKIP_WITH_FRONT_END();
 	mcheap_reinit();
 			  mcheap_allocate(100);
 	char *c = mcheap_allocate(20);
@@ -154,6 +316,7 @@ TEST test_realloc_ext_down(void)
 
 TEST test_realloc_ext_up(void)
 {
+	SKIP_WITH_FRONT_END();
 	mcheap_reinit();
 	char *a = mcheap_allocate(100);
 	char *b;
@@ -165,8 +328,28 @@ TEST test_realloc_ext_up(void)
 	PASS();
 }
 
+TEST test_realloc_ext_both(void)
+{
+	SKIP_WITH_FRONT_END();
+	mcheap_reinit();
+	char *a = mcheap_allocate(100);
+	char *b = mcheap_allocate(100);
+	char *c = mcheap_allocate(100);
+			  mcheap_allocate(20);
+	clutter(b, 100);
+	memcpy(buffers[0], b, 100);
+	mcheap_free(a);
+	mcheap_free(c);
+	b = mcheap_reallocate(b, 250);	// neither a nor c is large enough alone, should extend into both and shift down to a
+	ASSERT_EQ(b, a);
+	ASSERT_MEM_EQ(buffers[0], b, 100);
+	ASSERT(mcheap_is_intact());
+	PASS();
+}
+
 TEST test_realloc_higher(void)
 {
+	SKIP_WITH_FRONT_END();
 	mcheap_reinit();
 			  mcheap_allocate(100);
 	char *c = mcheap_allocate(20);
@@ -181,8 +364,66 @@ TEST test_realloc_higher(void)
 	PASS();
 }
 
+TEST test_realloc_preserve(void)
+{
+#ifdef MCHEAP_ENGINE_TLSF
+	SKIPm("TLSF does not prefer the lowest addressed fit");
+#endif
+	SKIP_WITH_FRONT_END();
+	mcheap_reinit();
+	char *a = mcheap_allocate(100);
+			  mcheap_allocate(20);
+	char *c = mcheap_allocate(20);
+	char *d = mcheap_allocate(100);
+	memset(a, 0x55, 100);
+	clutter(d, 100);
+	memcpy(buffers[0], d, 100);
+	mcheap_free(a);
+	mcheap_free(c);
+	d = mcheap_reallocate_ex(d, 100, 10);	// should relocate to a, copying only the first 10 bytes
+	ASSERT_EQ(a, d);
+	ASSERT_MEM_EQ(buffers[0], d, 10);
+	ASSERT(is_filled(d + 50, 0x55, 50));
+	PASS();
+}
+
+TEST test_realloc_copy_budget(void)
+{
+#ifdef MCHEAP_ENGINE_TLSF
+	SKIPm("TLSF does not prefer the lowest addressed fit");
+#endif
+	SKIP_WITH_FRONT_END();
+	mcheap_reinit();
+	char *a = mcheap_allocate(100);
+			  mcheap_allocate(20);
+	char *c = mcheap_allocate(100);
+	char *d;
+	size_t budget;
+	clutter(c, 100);
+	memcpy(buffers[0], c, 100);
+	mcheap_free(a);
+	budget = mcheap_set_copy_budget(50);
+	d = mcheap_reallocate(c, 90);	// copying 90 bytes is over budget, should shrink in place
+	ASSERT_EQ(d, c);
+	d = mcheap_reallocate(c, 40);	// copying 40 bytes is within budget, should relocate to a
+	mcheap_set_copy_budget(budget);
+	ASSERT_EQ(d, a);
+	ASSERT_MEM_EQ(buffers[0], d, 40);
+
+	mcheap_reinit();
+	a = mcheap_allocate(20);
+	c = mcheap_allocate(800);
+	mcheap_free(a);
+	d = mcheap_reallocate(c, 790);	// the space below is too little to be worth copying 790 bytes, should shrink in place
+	ASSERT_EQ(d, c);
+	d = mcheap_reallocate(c, 60);	// copying 60 bytes to close up the space is worth it, should extend down to a
+	ASSERT_EQ(d, a);
+	PASS();
+}
+
 TEST test_alloc_fail(void)
 {
+	SKIP_WITH_LOW_MMAP_THRESHOLD();
 	mcheap_reinit();
 	char *a = mcheap_allocate(MCHEAP_SIZE/2);
 	ASSERT(a);
@@ -193,6 +434,7 @@ TEST test_alloc_fail(void)
 
 TEST test_max_free(void)
 {
+	SKIP_WITH_LOW_MMAP_THRESHOLD();
 	mcheap_reinit();
 	mcheap_allocate(1000);
 	char *a = mcheap_allocate(1000);
@@ -214,6 +456,7 @@ TEST test_max_free(void)
 
 TEST test_intact(void)
 {
+	SKIP_WITH_FRONT_END();
 	mcheap_reinit();
   				mcheap_allocate(100);
 	char *c = 	mcheap_allocate(20);
@@ -234,15 +477,756 @@ TEST test_intact(void)
 	PASS();
 }
 
-TEST test_random(void)
+// Two heap instances in local buffers are independent of each other, and of the default heap
+TEST test_instances(void)
+{
+	static uint8_t buffer_a[INSTANCE_SIZE];
+	static uint8_t buffer_b[INSTANCE_SIZE];
+	mcheap_t *heap_a;
+	mcheap_t *heap_b;
+	size_t largest, largest_a, largest_b;
+	char *a, *b;
+
+	SKIP_WITH_LOW_MMAP_THRESHOLD();
+	ASSERT_EQ(mcheap_init(buffer_a, 8), NULL);	// too small for the control block
+
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	heap_a = mcheap_init(buffer_a, sizeof(buffer_a));
+	heap_b = mcheap_init(&buffer_b[1], sizeof(buffer_b) - 1);	// unaligned buffer
+	ASSERT(heap_a);
+	ASSERT(heap_b);
+	largest_a = mcheap_heap_largest_free(heap_a);
+	largest_b = mcheap_heap_largest_free(heap_b);
+	ASSERT(0 < largest_a && largest_a < INSTANCE_SIZE);
+	ASSERT(0 < largest_b && largest_b < INSTANCE_SIZE);
+
+	a = mcheap_heap_allocate(heap_a, largest_a);	// fill heap a
+	ASSERT((uint8_t*)a >= buffer_a && (uint8_t*)a + largest_a <= &buffer_a[INSTANCE_SIZE]);
+	ASSERT_EQ(mcheap_heap_allocate(heap_a, 1), NULL);
+	b = mcheap_heap_allocate(heap_b, 100);
+	ASSERT((uint8_t*)b > buffer_b && (uint8_t*)b + 100 <= &buffer_b[INSTANCE_SIZE]);
+	ASSERT_EQ(mcheap_largest_free(), largest);
+
+	memset(a, 0xAA, largest_a);
+	memset(b, 0x55, 100);
+	ASSERT(mcheap_heap_is_intact(heap_a));
+	ASSERT(mcheap_heap_is_intact(heap_b));
+	ASSERT(mcheap_is_intact());
+
+	b = mcheap_heap_reallocate(heap_b, b, 200);
+	ASSERT(b);
+	ASSERT(is_filled(b, 0x55, 100));
+	ASSERT(is_filled(a, 0xAA, largest_a));
+
+	mcheap_heap_free(heap_a, a);
+	mcheap_heap_free(heap_b, b);
+	mcheap_flush_cache();
+	ASSERT_EQ(mcheap_heap_largest_free(heap_a), largest_a);
+	ASSERT_EQ(mcheap_heap_largest_free(heap_b), largest_b);
+	ASSERT_EQ(mcheap_largest_free(), largest);
+	PASS();
+}
+
+// A heap with a fast region of higher priority, and a slow region of lower priority than it's own region
+// Allocations must fill the regions in order of priority, and a reallocation which doesn't fit it's region must move to another
+TEST test_regions(void)
+{
+	static uint8_t buffer[INSTANCE_SIZE];
+	static uint8_t fast[INSTANCE_SIZE];
+	static uint8_t slow[INSTANCE_SIZE*2];
+	char* ptrs[REGION_ALLOCATION_COUNT];
+	mcheap_t *heap;
+	size_t largest, total;
+	int i, count, region, last_region = 0;
+	char *a;
+
+	SKIP_WITH_LOW_MMAP_THRESHOLD();
+	heap = mcheap_init(buffer, sizeof(buffer));
+	ASSERT(heap);
+	total = mcheap_heap_total_free(heap);
+	ASSERT(!mcheap_heap_add_region(heap, fast, 8, 1));
+	ASSERT(mcheap_heap_add_region(heap, fast, sizeof(fast), 1));
+#ifdef MCHEAP_HANDLES
+	// a region has no handles of it's own, so it has more free space than a heap of the same size
+	ASSERT(mcheap_heap_total_free(heap) - total > total);
+#endif
+	ASSERT(mcheap_heap_add_region(heap, slow, sizeof(slow), -1));
+	ASSERT(mcheap_heap_total_free(heap) > total * 3);
+	ASSERT(mcheap_heap_is_intact(heap));
+	largest = mcheap_heap_largest_free(heap);
+
+	for(count = 0; count != REGION_ALLOCATION_COUNT; count++)
+	{
+		ptrs[count] = mcheap_heap_allocate(heap, REGION_ALLOCATION_SIZE);
+		if(!ptrs[count])
+			break;
+		memset(ptrs[count], count, REGION_ALLOCATION_SIZE);
+		region = IN_BUFFER(ptrs[count], fast) ? 0 : IN_BUFFER(ptrs[count], buffer) ? 1 : IN_BUFFER(ptrs[count], slow) ? 2 : -1;
+		ASSERT(region >= last_region);
+		last_region = region;
+	};
+	ASSERT_EQ(last_region, 2);
+	ASSERT(count < REGION_ALLOCATION_COUNT);
+	ASSERT(mcheap_heap_is_intact(heap));
+
+	for(i = 0; i != count; i++)
+	{
+		ASSERT(is_filled(ptrs[i], i, REGION_ALLOCATION_SIZE));
+		mcheap_heap_free(heap, ptrs[i]);
+	};
+
+	a = mcheap_heap_allocate(heap, 1000);
+	ASSERT(IN_BUFFER(a, fast));
+	memset(a, 0x55, 1000);
+	a = mcheap_heap_reallocate(heap, a, INSTANCE_SIZE + 100);
+	ASSERT(IN_BUFFER(a, slow));
+	ASSERT(is_filled(a, 0x55, 1000));
+	mcheap_heap_free(heap, a);
+
+	mcheap_flush_cache();
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), largest);
+	PASS();
+}
+
+// A heap in reserved address space starts small, and grows as allocations need it, up to the reserved size
+TEST test_reserve(void)
+{
+#ifdef MCHEAP_GROWABLE
+	mcheap_t *heap = mcheap_reserve(RESERVE_SIZE);
+	char *a, *b;
+
+	ASSERT(heap);
+	ASSERT(mcheap_heap_total_free(heap) < RESERVE_SIZE/16);
+
+	a = mcheap_heap_allocate(heap, RESERVE_SIZE/4);
+	ASSERT(a);
+	memset(a, 0x55, RESERVE_SIZE/4);
+	b = mcheap_heap_allocate(heap, RESERVE_SIZE/2);
+	ASSERT(b);
+	ASSERT_EQ(mcheap_heap_allocate(heap, RESERVE_SIZE/2), NULL);
+	ASSERT(mcheap_heap_is_intact(heap));
+
+	b = mcheap_heap_reallocate(heap, b, RESERVE_SIZE/2 + RESERVE_SIZE/8);	// extends up into new space
+	ASSERT(b);
+	mcheap_heap_free(heap, b);
+	a = mcheap_heap_reallocate(heap, a, RESERVE_SIZE/2 + RESERVE_SIZE/4);
+	ASSERT(a);
+	ASSERT(is_filled(a, 0x55, RESERVE_SIZE/4));
+	ASSERT(mcheap_heap_is_intact(heap));
+
+	mcheap_heap_free(heap, a);
+	ASSERT(mcheap_heap_largest_free(heap) > RESERVE_SIZE/2 + RESERVE_SIZE/4);
+	ASSERT(mcheap_heap_is_intact(heap));
+	PASS();
+#else
+	SKIPm("MCHEAP_GROWABLE is not defined");
+#endif
+}
+
+// The pages of a large free section are returned to the operating system, automatically on free and on demand, without breaking the heap
+// Released pages read back as zero with the default MCHEAP_TRIM_ADVICE of MADV_DONTNEED
+// Except in a shared mapping, where they read back with their old content, so they must not be taken to be zero
+TEST test_trim(void)
+{
+#ifdef MCHEAP_TRIM
+	static uint8_t buffer[TRIM_BUFFER_SIZE];
+	mcheap_t *heap = mcheap_init(buffer, sizeof(buffer));
+	size_t released;
+	char *a, *b;
+	void* shared;
+
+	ASSERT(heap);
+	a = mcheap_heap_allocate(heap, TRIM_BUFFER_SIZE/2);
+	b = mcheap_heap_allocate(heap, 100);
+	ASSERT(a);
+	ASSERT(b);
+	memset(a, 0x55, TRIM_BUFFER_SIZE/2);
+	memset(b, 0x55, 100);
+
+	mcheap_heap_free(heap, a);	// above MCHEAP_TRIM_THRESHOLD
+	ASSERT(mcheap_heap_is_intact(heap));
+	a = mcheap_heap_allocate(heap, TRIM_BUFFER_SIZE/2);
+	ASSERT(a);
+	ASSERT(is_filled(&a[TRIM_BUFFER_SIZE/8], 0, TRIM_BUFFER_SIZE/4));
+
+	memset(a, 0x55, TRIM_BUFFER_SIZE/2);
+	mcheap_heap_free(heap, a);
+	released = mcheap_heap_trim(heap);
+	ASSERT(released > TRIM_BUFFER_SIZE/2);
+	ASSERT(released < TRIM_BUFFER_SIZE);
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT(is_filled(b, 0x55, 100));
+	mcheap_heap_free(heap, b);
+
+	// a free into a section which has already been trimmed only releases it's own pages, the rest of the section isn't released again
+	// the pattern is written to the free section above a directly, to see that it's pages aren't released
+	a = mcheap_heap_allocate(heap, TRIM_BUFFER_SIZE/4);
+	ASSERT(a);
+	b = &a[TRIM_BUFFER_SIZE/2];
+	memset(a, 0x55, TRIM_BUFFER_SIZE/4);
+	memset(b, 0x55, TRIM_BUFFER_SIZE/8);
+	mcheap_heap_free(heap, a);
+	ASSERT(is_filled(b, 0x55, TRIM_BUFFER_SIZE/8));
+	a = mcheap_heap_allocate(heap, TRIM_BUFFER_SIZE/4);
+	ASSERT(a);
+	ASSERT(is_filled(&a[TRIM_BUFFER_SIZE/16], 0, TRIM_BUFFER_SIZE/8));
+	mcheap_heap_free(heap, a);
+	ASSERT(mcheap_heap_is_intact(heap));
+
+	shared = mmap(NULL, TRIM_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	ASSERT(shared != MAP_FAILED);
+	heap = mcheap_init(shared, TRIM_BUFFER_SIZE);
+	ASSERT(heap);
+	a = mcheap_heap_allocate(heap, TRIM_BUFFER_SIZE/2);
+	ASSERT(a);
+	memset(a, 0x55, TRIM_BUFFER_SIZE/2);
+	mcheap_heap_free(heap, a);
+	mcheap_heap_trim(heap);
+	a = mcheap_heap_allocate_zeroed(heap, TRIM_BUFFER_SIZE/2);
+	ASSERT(a);
+	ASSERT(is_filled(a, 0, TRIM_BUFFER_SIZE/2));
+	munmap(shared, TRIM_BUFFER_SIZE);
+	PASS();
+#else
+	SKIPm("MCHEAP_TRIM is not defined");
+#endif
+}
+
+// Allocations larger than the heap are given their own mapping, which is resized by reallocate, until it shrinks back into the heap
+TEST test_mapped(void)
+{
+#ifdef MCHEAP_MMAP_THRESHOLD
+	size_t largest;
+	char *a;
+
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	a = mcheap_allocate(MAPPED_SIZE);
+	ASSERT(a);
+	ASSERT_EQ(mcheap_largest_free(), largest);
+	memset(a, 0x55, MAPPED_SIZE);
+
+	a = mcheap_reallocate(a, MAPPED_SIZE*4);
+	ASSERT(a);
+	ASSERT(is_filled(a, 0x55, MAPPED_SIZE));
+	memset(a, 0x55, MAPPED_SIZE*4);
+	a = mcheap_reallocate(a, MAPPED_SIZE/2);
+	ASSERT(a);
+	ASSERT(is_filled(a, 0x55, MAPPED_SIZE/2));
+	ASSERT_EQ(mcheap_largest_free(), largest);
+
+	a = mcheap_reallocate(a, 100);	// moves back into the heap
+	ASSERT(a);
+	ASSERT(is_filled(a, 0x55, 100));
+	ASSERT(mcheap_largest_free() < largest);
+	a = mcheap_reallocate(a, MAPPED_SIZE);	// and out again
+	ASSERT(a);
+	ASSERT(is_filled(a, 0x55, 100));
+	ASSERT_EQ(mcheap_largest_free(), largest);
+
+	mcheap_free(a);
+	mcheap_flush_cache();
+	ASSERT_EQ(mcheap_largest_free(), largest);
+	ASSERT(mcheap_is_intact());
+	PASS();
+#else
+	SKIPm("MCHEAP_MMAP_THRESHOLD is not defined");
+#endif
+}
+
+// Aligned allocations must be aligned, and the padding below them must be returned to the heap
+// Aligned reallocations must stay aligned and preserve the content
+TEST test_aligned(void)
+{
+	static uint8_t buffer[ALIGNED_BUFFER_SIZE];
+	mcheap_t *heap = mcheap_init(buffer, sizeof(buffer));
+	size_t largest, total;
+	char *a, *b, *c;
+
+	ASSERT(heap);
+	largest = mcheap_heap_largest_free(heap);
+	total = mcheap_heap_total_free(heap);
+
+	c = mcheap_heap_allocate_aligned(heap, 1000, 4096);
+	ASSERT(c);
+	ASSERT_EQ((uintptr_t)c % 4096, 0);
+	ASSERT(total - mcheap_heap_total_free(heap) < 1000 + 256);	// the padding is still free
+	a = mcheap_heap_allocate_aligned(heap, 100, 64);
+	b = mcheap_heap_allocate_aligned(heap, 300, 256);
+	ASSERT(a);
+	ASSERT(b);
+	ASSERT_EQ((uintptr_t)a % 64, 0);
+	ASSERT_EQ((uintptr_t)b % 256, 0);
+	ASSERT_EQ(mcheap_heap_allocate_aligned(heap, 100, 48), NULL);
+	ASSERT(mcheap_heap_is_intact(heap));
+	memset(a, 0x11, 100);
+	memset(b, 0x22, 300);
+	memset(c, 0x33, 1000);
+
+	ASSERT_EQ(mcheap_heap_reallocate_aligned(heap, a, 50, 64), a);	// shrinks in place
+	b = mcheap_heap_reallocate_aligned(heap, b, 3000, 512);
+	ASSERT(b);
+	ASSERT_EQ((uintptr_t)b % 512, 0);
+	c = mcheap_heap_reallocate_aligned(heap, c, 2000, 4096);
+	ASSERT(c);
+	ASSERT_EQ((uintptr_t)c % 4096, 0);
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT(is_filled(a, 0x11, 50));
+	ASSERT(is_filled(b, 0x22, 300));
+	ASSERT(is_filled(c, 0x33, 1000));
+
+	mcheap_heap_free(heap, a);
+	mcheap_heap_free(heap, b);
+	mcheap_heap_free(heap, c);
+	mcheap_flush_cache();
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), largest);
+
+	// with the rest of the heap used, an aligned allocation fits the space left by one of the same size and alignment
+	a = mcheap_heap_allocate_aligned(heap, 1000, 64);
+	b = mcheap_heap_allocate(heap, mcheap_heap_largest_free(heap));
+	ASSERT(a);
+	ASSERT(b);
+	mcheap_heap_free(heap, a);
+	ASSERT_EQ(mcheap_heap_allocate_aligned(heap, 1000, 64), a);
+	mcheap_heap_free(heap, a);
+	mcheap_heap_free(heap, b);
+	mcheap_flush_cache();
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), largest);
+	PASS();
+}
+
+// Zeroed allocations must read back as zero, whether they reuse memory which has been written, or memory which is known to be zero
+// A heap in reserved address space starts out zero, and grows into more zero memory, so that MCHEAP_TRACK_ZERO has something to track
+TEST test_zeroed(void)
+{
+	static uint8_t buffer[ZEROED_BUFFER_SIZE];
+	char* ptrs[ZEROED_ALLOCATION_COUNT] = {NULL};
+	mcheap_t *heap;
+	size_t largest, size;
+	int i, round;
+	char *a;
+
+#ifdef MCHEAP_GROWABLE
+	(void)buffer;
+	heap = mcheap_reserve(RESERVE_SIZE);
+#else
+	memset(buffer, 0x55, sizeof(buffer));
+	heap = mcheap_init(buffer, sizeof(buffer));
+#endif
+	ASSERT(heap);
+	largest = mcheap_heap_largest_free(heap);
+
+	for(round = 0; round != ZEROED_ROUND_COUNT; round++)
+	{
+		for(i = 0; i != ZEROED_ALLOCATION_COUNT; i++)
+		{
+			if(!ptrs[i])
+			{
+				size = 1 + rand() % ZEROED_MAX_SIZE;
+				ptrs[i] = mcheap_heap_allocate_zeroed(heap, size);
+				ASSERT(ptrs[i]);
+				ASSERT(is_filled(ptrs[i], 0, size));
+				memset(ptrs[i], 0x55, size);
+			}
+			else if(rand() % 2)
+				ptrs[i] = mcheap_heap_free(heap, ptrs[i]);
+		};
+		ASSERT(mcheap_heap_is_intact(heap));
+	};
+
+	for(i = 0; i != ZEROED_ALLOCATION_COUNT; i++)
+		mcheap_heap_free(heap, ptrs[i]);
+
+	for(i = 0; i != 2; i++)
+	{
+		a = mcheap_heap_allocate_zeroed(heap, ZEROED_LARGE_SIZE);
+		ASSERT(a);
+		ASSERT(is_filled(a, 0, ZEROED_LARGE_SIZE));
+		memset(a, 0x55, ZEROED_LARGE_SIZE);
+		mcheap_heap_free(heap, a);
+	};
+
+	mcheap_flush_cache();
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT(mcheap_heap_largest_free(heap) >= largest);
+	PASS();
+}
+
+// A batch is carved from one free section, so it's allocations are consecutive, and freeing them as a batch in random order must restore the heap
+// Allocations made separately, including any from the slab layer or the thread cache, may also be freed as a batch
+TEST test_batch(void)
+{
+	static uint8_t buffer[BATCH_BUFFER_SIZE];
+	mcheap_t *heap = mcheap_init(buffer, sizeof(buffer));
+	size_t sizes[BATCH_COUNT];
+	void* ptrs[BATCH_COUNT];
+	void* swap;
+	size_t largest;
+	int i, j;
+
+	SKIP_WITH_LOW_MMAP_THRESHOLD();
+	ASSERT(heap);
+	largest = mcheap_heap_largest_free(heap);
+	for(i = 0; i != BATCH_COUNT; i++)
+		sizes[i] = 1 + rand() % BATCH_MAX_SIZE;
+
+	ASSERT(mcheap_heap_allocate_batch(heap, sizes, ptrs, BATCH_COUNT));
+	for(i = 0; i != BATCH_COUNT; i++)
+	{
+		ASSERT(i == 0 || (char*)ptrs[i] >= (char*)ptrs[i-1] + sizes[i-1]);
+		ASSERT(i == 0 || (char*)ptrs[i] <= (char*)ptrs[i-1] + sizes[i-1] + BATCH_MAX_SIZE);
+		memset(ptrs[i], i, sizes[i]);
+	};
+	ASSERT(mcheap_heap_is_intact(heap));
+	for(i = 0; i != BATCH_COUNT; i++)
+		ASSERT(is_filled(ptrs[i], i, sizes[i]));
+
+	for(i = BATCH_COUNT; i; i--)
+	{
+		j = rand() % i;
+		swap = ptrs[j];
+		ptrs[j] = ptrs[i-1];
+		ptrs[i-1] = swap;
+	};
+	mcheap_heap_free_batch(heap, ptrs, BATCH_COUNT);
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), largest);
+
+	for(i = 0; i != BATCH_COUNT; i++)
+	{
+		ptrs[i] = mcheap_heap_allocate(heap, sizes[i]);
+		ASSERT(ptrs[i]);
+	};
+	ptrs[BATCH_COUNT/2] = mcheap_heap_free(heap, ptrs[BATCH_COUNT/2]);	// NULL is ignored
+	mcheap_heap_free_batch(heap, ptrs, BATCH_COUNT);
+	mcheap_flush_cache();
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), largest);
+
+	sizes[BATCH_COUNT-1] = BATCH_BUFFER_SIZE;
+	ASSERT(!mcheap_heap_allocate_batch(heap, sizes, ptrs, BATCH_COUNT));
+	ASSERT_EQ(ptrs[0], NULL);
+	mcheap_flush_cache();
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), largest);
+	PASS();
+}
+
+// Allocations reallocated and freed with the sizes they were made with, must behave as they do without the sizes
+TEST test_sized(void)
+{
+	char* ptrs[SMALL_ALLOCATION_COUNT];
+	size_t sizes[SMALL_ALLOCATION_COUNT];
+	size_t largest;
+	size_t new_size;
+	int i;
+
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	for(i = 0; i != SMALL_ALLOCATION_COUNT; i++)
+	{
+		sizes[i] = 1 + rand() % SMALL_MAX_SIZE;
+		ptrs[i] = mcheap_allocate(sizes[i]);
+		ASSERT(ptrs[i]);
+		memset(ptrs[i], i, sizes[i]);
+	};
+
+	for(i = 0; i != SMALL_ALLOCATION_COUNT; i++)
+	{
+		new_size = 1 + rand() % SMALL_MAX_SIZE;
+		ptrs[i] = mcheap_reallocate_sized(ptrs[i], sizes[i], new_size);
+		ASSERT(ptrs[i]);
+		ASSERT(is_filled(ptrs[i], i, SMALLEST_OF(sizes[i], new_size)));
+		sizes[i] = new_size;
+		memset(ptrs[i], i, sizes[i]);
+	};
+	ASSERT(mcheap_is_intact());
+
+	for(i = 0; i != SMALL_ALLOCATION_COUNT; i++)
+	{
+		ASSERT(is_filled(ptrs[i], i, sizes[i]));
+		ASSERT_EQ(mcheap_free_sized(ptrs[i], sizes[i]), NULL);
+	};
+
+	mcheap_flush_cache();
+	ASSERT(mcheap_is_intact());
+	ASSERT_EQ(largest, mcheap_largest_free());
+	PASS();
+}
+
+// Allocations are resized in place, growing only once the allocation after them is freed, and never moving
+TEST test_resize(void)
+{
+	char *a, *b, *c;
+	size_t largest;
+	size_t usable;
+
+	SKIP_WITH_LOW_MMAP_THRESHOLD();
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	a = mcheap_allocate(RESIZE_SIZE);
+	b = mcheap_allocate(RESIZE_SIZE);
+	c = mcheap_allocate(1);
+	ASSERT(a && b && c);
+
+	usable = mcheap_usable_size(a);
+	ASSERT(usable >= RESIZE_SIZE);
+	memset(a, 1, usable);
+	ASSERT(mcheap_try_resize(c, mcheap_usable_size(c)));
+	ASSERT(!mcheap_try_resize(a, 2*MCHEAP_SIZE));
+	ASSERT(!mcheap_try_resize(NULL, RESIZE_SIZE));
+	ASSERT(!mcheap_try_resize(a, 0));
+	ASSERT_EQ(mcheap_usable_size(NULL), 0);
+
+	mcheap_free(b);
+	ASSERT(mcheap_try_resize(a, 2*RESIZE_SIZE));
+	ASSERT(mcheap_usable_size(a) >= 2*RESIZE_SIZE);
+	ASSERT(is_filled(a, 1, usable));
+	ASSERT(mcheap_try_resize(a, RESIZE_SIZE/2));
+	ASSERT(mcheap_usable_size(a) < RESIZE_SIZE);
+	ASSERT(is_filled(a, 1, RESIZE_SIZE/2));
+	ASSERT(mcheap_is_intact());
+
+	mcheap_free(a);
+	mcheap_free(c);
+	mcheap_flush_cache();
+	ASSERT(mcheap_is_intact());
+	ASSERT_EQ(largest, mcheap_largest_free());
+	PASS();
+}
+
+// Every other handle allocation is freed, and compacting the heap moves the rest down, except for a locked one
+// Once it is unlocked, compacting leaves all the free space in one section
+TEST test_handles(void)
+{
+#ifdef MCHEAP_HANDLES
+	mcheap_handle_t handles[HANDLE_TEST_COUNT];
+	size_t sizes[HANDLE_TEST_COUNT];
+	size_t largest;
+	char *locked;
+	char *p;
+	int i;
+
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	for(i = 0; i != HANDLE_TEST_COUNT; i++)
+	{
+		sizes[i] = 1 + rand() % SMALL_MAX_SIZE;
+		handles[i] = mcheap_handle_allocate(sizes[i]);
+		ASSERT(handles[i]);
+		memset(mcheap_handle_lock(handles[i]), i, sizes[i]);
+		mcheap_handle_unlock(handles[i]);
+	};
+
+	for(i = 1; i < HANDLE_TEST_COUNT; i += 2)
+		mcheap_handle_free(handles[i]);
+	ASSERT(mcheap_largest_free() < mcheap_total_free());
+	ASSERT_EQ(mcheap_compact(0), 0);
+
+	locked = mcheap_handle_lock(handles[HANDLE_TEST_COUNT/2]);
+	ASSERT(mcheap_compact(SIZE_MAX));
+	ASSERT_EQ(mcheap_handle_lock(handles[HANDLE_TEST_COUNT/2]), locked);
+	mcheap_handle_unlock(handles[HANDLE_TEST_COUNT/2]);
+	mcheap_handle_unlock(handles[HANDLE_TEST_COUNT/2]);
+	ASSERT(mcheap_largest_free() < mcheap_total_free());
+
+	ASSERT(mcheap_compact(SIZE_MAX));
+	ASSERT_EQ(mcheap_largest_free(), mcheap_total_free());
+	ASSERT(mcheap_is_intact());
+
+	for(i = 0; i < HANDLE_TEST_COUNT; i += 2)
+	{
+		p = mcheap_handle_lock(handles[i]);
+		ASSERT(is_filled(p, i, sizes[i]));
+		mcheap_handle_unlock(handles[i]);
+		mcheap_handle_free(handles[i]);
+	};
+
+	ASSERT(mcheap_is_intact());
+	ASSERT_EQ(largest, mcheap_largest_free());
+	PASS();
+#else
+	ASSERT_EQ(mcheap_handle_allocate(1), NULL);
+	SKIPm("MCHEAP_HANDLES is not defined");
+#endif
+}
+
+// Every other registered allocation is freed, and stepping the defragmenter moves the rest down, updating their pointers through the hook
+TEST test_defrag(void)
+{
+#ifdef MCHEAP_HANDLES
+	mcheap_handle_t handles[HANDLE_TEST_COUNT];
+	char* ptrs[HANDLE_TEST_COUNT];
+	size_t sizes[HANDLE_TEST_COUNT];
+	size_t largest;
+	int i;
+
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	ASSERT_EQ(mcheap_register(NULL, move_hook, NULL), NULL);
+	for(i = 0; i != HANDLE_TEST_COUNT; i++)
+	{
+		sizes[i] = RESIZE_SIZE/4 + rand() % RESIZE_SIZE;	// larger than MCHEAP_SLAB_MAX, so that every allocation can be registered
+		ptrs[i] = mcheap_allocate(sizes[i]);
+		ASSERT(ptrs[i]);
+		memset(ptrs[i], i, sizes[i]);
+		handles[i] = mcheap_register(ptrs[i], move_hook, &ptrs[i]);
+		ASSERT(handles[i]);
+	};
+
+	for(i = 1; i < HANDLE_TEST_COUNT; i += 2)
+	{
+		mcheap_unregister(handles[i]);
+		mcheap_free(ptrs[i]);
+	};
+	mcheap_flush_cache();
+	ASSERT(mcheap_largest_free() < mcheap_total_free());
+	ASSERT_EQ(mcheap_defrag_step(0), 0);
+
+#ifdef MCHEAP_AUTO_DEFRAG
+	// an allocation larger than any free section succeeds by compacting the heap
+	ptrs[1] = mcheap_allocate(mcheap_largest_free() + 1);
+	ASSERT(ptrs[1]);
+	mcheap_free(ptrs[1]);
+#endif
+
+	for(i = 0; i != HANDLE_TEST_COUNT; i++)
+		mcheap_defrag_step(2*RESIZE_SIZE);
+	mcheap_flush_cache();
+	ASSERT_EQ(mcheap_largest_free(), mcheap_total_free());
+	ASSERT(mcheap_is_intact());
+
+	for(i = 0; i < HANDLE_TEST_COUNT; i += 2)
+	{
+		ASSERT(is_filled(ptrs[i], i, sizes[i]));
+		mcheap_handle_free(handles[i]);
+	};
+
+	mcheap_flush_cache();
+	ASSERT(mcheap_is_intact());
+	ASSERT_EQ(largest, mcheap_largest_free());
+	PASS();
+#else
+	SKIPm("MCHEAP_HANDLES is not defined");
+#endif
+}
+
+// With MCHEAP_SIZE below 32K, section sizes are 16 bits, so a buffer of 128K is refused
+// A heap within the range must still be usable right up to it's end
+TEST test_compact_headers(void)
+{
+#if defined(MCHEAP_COMPACT_HEADERS) && MCHEAP_SIZE <= 0x7FFF
+	static uint8_t buffer[0x20000] __attribute__((aligned(64)));
+	mcheap_t *heap;
+	size_t largest;
+	char *a, *b;
+
+	ASSERT(!mcheap_init(buffer, sizeof(buffer)));
+	heap = mcheap_init(buffer, COMPACT_BUFFER_SIZE);
+	ASSERT(heap);
+	largest = mcheap_heap_largest_free(heap);
+	ASSERT(largest > COMPACT_BUFFER_SIZE/2);
+
+	a = mcheap_heap_allocate(heap, RESIZE_SIZE);
+	b = mcheap_heap_allocate(heap, mcheap_heap_largest_free(heap));
+	ASSERT(a && b);
+	memset(a, 0x11, RESIZE_SIZE);
+	memset(b, 0x22, mcheap_heap_usable_size(heap, b));
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), 0);
+
+	mcheap_heap_free(heap, a);
+	mcheap_heap_free(heap, b);
+	ASSERT(mcheap_heap_is_intact(heap));
+	ASSERT_EQ(mcheap_heap_largest_free(heap), largest);
+	PASS();
+#else
+	SKIPm("MCHEAP_COMPACT_HEADERS is not defined, or MCHEAP_SIZE is too large for 16 bit sizes");
+#endif
+}
+
+// Many small allocations of random sizes, which are filled, reallocated and then freed in random order
+// All the space must be recovered once they are freed
+TEST test_small(void)
+{
+	char* ptrs[SMALL_ALLOCATION_COUNT];
+	size_t sizes[SMALL_ALLOCATION_COUNT];
+	size_t largest;
+	size_t new_size;
+	char* new_ptr;
+	char* swap;
+	int i, j;
+
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	for(i = 0; i != SMALL_ALLOCATION_COUNT; i++)
+	{
+		sizes[i] = 1 + rand() % SMALL_MAX_SIZE;
+		ptrs[i] = mcheap_allocate(sizes[i]);
+		ASSERT(ptrs[i]);
+		memset(ptrs[i], i, sizes[i]);
+	};
+
+	for(i = 0; i != SMALL_ALLOCATION_COUNT; i++)
+	{
+		ASSERT(is_filled(ptrs[i], i, sizes[i]));
+		new_size = 1 + rand() % SMALL_MAX_SIZE;
+		new_ptr = mcheap_reallocate(ptrs[i], new_size);
+		if(new_ptr)
+		{
+			ASSERT(is_filled(new_ptr, i, SMALLEST_OF(sizes[i], new_size)));
+			memset(new_ptr, i, new_size);
+			ptrs[i] = new_ptr;
+			sizes[i] = new_size;
+		};
+	};
+
+	for(i = 0; i != SMALL_ALLOCATION_COUNT; i++)
+		ASSERT(is_filled(ptrs[i], i, sizes[i]));
+
+	// free in random order
+	for(i = SMALL_ALLOCATION_COUNT; i; i--)
+	{
+		j = rand() % i;
+		swap = ptrs[j];
+		ptrs[j] = ptrs[i-1];
+		ptrs[i-1] = swap;
+		mcheap_free(ptrs[i-1]);
+	};
+
+	mcheap_flush_cache();
+	ASSERT(mcheap_is_intact());
+	ASSERT_EQ(largest, mcheap_largest_free());
+	PASS();
+}
+
+// Random activity with each placement policy, or the fixed placement of the other engines, reporting the mean fragmentation and the mean time per heap operation
+TEST test_random(mcheap_placement_t placement)
 {
 	char* ptrs[ALLOCATION_COUNT] = {0};
 	int sizes[ALLOCATION_COUNT];
 	int i;
 	int err;
 	uint32_t count = RANDOM_OP_COUNT;
+	uint64_t start;
+	double fragmentation_sum = 0;
+	const char* placement_name = placement_names[placement];
+
+	// the other engines have their own fixed placement, which is measured in place of first fit
+	if(!mcheap_set_placement(placement))
+	{
+		if(placement != MCHEAP_FIRST_FIT)
+			SKIPm("placement not supported by " ENGINE_NAME " engine");
+		placement_name = ENGINE_PLACEMENT;
+	};
+
 	mcheap_reinit();
-	printf("Testing random heap activity with %"PRIu32" operations\n", count);
+	random_heap_time = 0;
+	printf("Testing random heap activity with %s placement, %"PRIu32" operations\n", placement_name, count);
 	while(count--)
 	{
 		// allocate or free
@@ -251,7 +1235,9 @@ TEST test_random(void)
 		{
 			if(rand() % 2)
 			{
+				start = CYCLES();
 				ptrs[i] = mcheap_free(ptrs[i]);
+				random_heap_time += CYCLES() - start;
 				count_free++;
 			}
 			else
@@ -266,7 +1252,9 @@ TEST test_random(void)
 			sizes[i] = choose_allocation_size();
 			if(sizes[i])
 			{
+				start = CYCLES();
 				ptrs[i] = mcheap_allocate(sizes[i]);
+				random_heap_time += CYCLES() - start;
 				clutter(ptrs[i], sizes[i]);
 				memcpy(buffers[i], ptrs[i], sizes[i]);
 				count_allocate++;
@@ -284,9 +1272,110 @@ TEST test_random(void)
 
 		// check heap integrity
 		ASSERT(mcheap_is_intact());
+		fragmentation_sum += fragmentation();
 		if((count & 0x0000FFFF) == 0)
 			printf("allocate=%"PRIu32", free=%"PRIu32", realloc_bigger=%"PRIu32", realloc_same=%"PRIu32", realloc_smaller=%"PRIu32", total=%"PRIu32"\n", count_allocate, count_free, count_realloc_bigger, count_realloc_same, count_realloc_smaller, count_allocate+count_free+count_realloc_bigger+count_realloc_same+count_realloc_smaller);
 	};
+	printf("%s: mean fragmentation=%.1f%%, mean=%"PRIu64" %s per operation\n", placement_name, 100.0*fragmentation_sum/RANDOM_OP_COUNT, random_heap_time/RANDOM_OP_COUNT, CYCLES_UNIT);
+	mcheap_set_placement(MCHEAP_FIRST_FIT);
+	mcheap_reinit();
+	PASS();
+}
+
+// Random activity from several threads at once, each checking the content of it's own allocations
+// All the space must be recovered once the threads have freed their allocations
+TEST test_threads(void)
+{
+#ifdef MCHEAP_THREAD_SAFE
+	pthread_t threads[THREAD_COUNT];
+	unsigned int seeds[THREAD_COUNT];
+	void* errors;
+	size_t largest;
+	uint64_t start;
+	int i;
+
+	mcheap_reinit();
+	largest = mcheap_largest_free();
+	printf("Testing random heap activity from %d threads, with %d operations each\n", THREAD_COUNT, THREAD_OP_COUNT);
+	start = clock_ns();
+	for(i = 0; i != THREAD_COUNT; i++)
+	{
+		seeds[i] = rand();
+		ASSERT_EQ(0, pthread_create(&threads[i], NULL, thread_random, &seeds[i]));
+	};
+
+	for(i = 0; i != THREAD_COUNT; i++)
+	{
+		ASSERT_EQ(0, pthread_join(threads[i], &errors));
+		ASSERT_EQ(NULL, errors);
+	};
+	printf("%.0f operations per second\n", THREAD_COUNT * THREAD_OP_COUNT * 1e9 / (clock_ns() - start));
+
+	ASSERT(mcheap_is_intact());
+	ASSERT_EQ(largest, mcheap_largest_free());
+	PASS();
+#else
+	SKIPm("MCHEAP_THREAD_SAFE not defined");
+#endif
+}
+
+// Measure the worst case time of each operation, with many small allocations fragmenting the heap
+TEST test_latency(void)
+{
+	char* ptrs[LATENCY_ALLOCATION_COUNT] = {0};
+	uint64_t worst[3] = {0};
+	uint64_t total[3] = {0};
+	uint32_t ops[3] = {0};
+	const char* names[3] = {"allocate", "reallocate", "free"};
+	uint64_t start, elapsed;
+	uint32_t count = LATENCY_OP_COUNT;
+	size_t size;
+	int i, op;
+
+	mcheap_reinit();
+	printf("Measuring %s engine with %"PRIu32" operations\n", ENGINE_NAME, count);
+	while(count--)
+	{
+		i = rand() % LATENCY_ALLOCATION_COUNT;
+		size = 1 + rand() % (MCHEAP_SIZE/LATENCY_ALLOCATION_COUNT);
+		if(!ptrs[i])
+		{
+			op = 0;
+			start = CYCLES();
+			ptrs[i] = mcheap_allocate(size);
+			elapsed = CYCLES() - start;
+		}
+		else if(rand() % 2)
+		{
+			op = 1;
+			start = CYCLES();
+			ptrs[i] = mcheap_reallocate(ptrs[i], size);
+			elapsed = CYCLES() - start;
+		}
+		else
+		{
+			op = 2;
+			start = CYCLES();
+			ptrs[i] = mcheap_free(ptrs[i]);
+			elapsed = CYCLES() - start;
+		};
+
+		// don't record while the heap is first being touched
+		if(count < LATENCY_OP_COUNT - LATENCY_WARMUP_COUNT)
+		{
+			if(elapsed > worst[op])
+				worst[op] = elapsed;
+			total[op] += elapsed;
+			ops[op]++;
+		};
+	};
+	ASSERT(mcheap_is_intact());
+
+	for(op = 0; op != 3; op++)
+	{
+		if(ops[op])
+			printf("%-10s worst=%"PRIu64" mean=%"PRIu64" %s\n", names[op], worst[op], total[op]/ops[op], CYCLES_UNIT);
+	};
 	mcheap_reinit();
 	PASS();
 }
@@ -298,9 +1387,13 @@ static int random_realloc(char **ptr_ptr, int *size_ptr, uint8_t buf[MCHEAP_SIZE
 	int new_size = choose_allocation_size();
 	int retval = 0;
 
+	uint64_t start;
+
 	if(new_size >= old_size)
 	{
+		start = CYCLES();
 		ptr = mcheap_reallocate(ptr, new_size);			// potentially increase allocation size
+		random_heap_time += CYCLES() - start;
 		if(memcmp(buf, ptr, old_size))					// check content was not destroyed on size increase
 			retval = ERR_REALLOC_BROKE_ON_INCREASE;
 		clutter(ptr, new_size);							// create new content
@@ -313,7 +1406,9 @@ static int random_realloc(char **ptr_ptr, int *size_ptr, uint8_t buf[MCHEAP_SIZE
 	else
 	{
 		memcpy(buf, ptr, new_size);							// update buffer with smaller content
+		start = CYCLES();
 		ptr = mcheap_reallocate(ptr, new_size);				// decrease allocation size
+		random_heap_time += CYCLES() - start;
 		if(memcmp(buf, ptr, new_size))						// check remaining content was not destroyed
 			retval = ERR_REALLOC_BROKE_ON_DECREASE;
 		count_realloc_smaller++;
@@ -330,6 +1425,90 @@ static void clutter(char* dst, size_t sz)
 		*dst++ = (char)rand();
 }
 
+static bool is_filled(char* ptr, char value, size_t sz)
+{
+	while(sz && *ptr++ == value)
+		sz--;
+	return !sz;
+}
+
+// Move hook for test_defrag, arg addresses the pointer to the allocation
+static void move_hook(void* old_ptr, void* new_ptr, void* arg)
+{
+	if(*(void**)arg == old_ptr)
+		*(void**)arg = new_ptr;
+}
+
+#ifdef MCHEAP_THREAD_SAFE
+// Thread for test_threads, arg is the seed for rand_r()
+// Returns the number of errors found, as a pointer
+static void* thread_random(void* arg)
+{
+	unsigned int *seed = arg;
+	char* ptrs[THREAD_ALLOCATION_COUNT] = {0};
+	size_t sizes[THREAD_ALLOCATION_COUNT];
+	char values[THREAD_ALLOCATION_COUNT];
+	uint32_t count = THREAD_OP_COUNT;
+	intptr_t errors = 0;
+	size_t size;
+	char* new_ptr;
+	int i;
+
+	while(count--)
+	{
+		i = rand_r(seed) % THREAD_ALLOCATION_COUNT;
+		size = 1 + rand_r(seed) % THREAD_MAX_SIZE;
+		if(!ptrs[i])
+		{
+			ptrs[i] = mcheap_allocate(size);
+			sizes[i] = size;
+		}
+		else if(rand_r(seed) % 2)
+		{
+			new_ptr = mcheap_reallocate(ptrs[i], size);
+			if(new_ptr)
+			{
+				if(!is_filled(new_ptr, values[i], SMALLEST_OF(sizes[i], size)))
+					errors++;
+				ptrs[i] = new_ptr;
+				sizes[i] = size;
+			};
+		}
+		else
+		{
+			if(!is_filled(ptrs[i], values[i], sizes[i]))
+				errors++;
+			ptrs[i] = mcheap_free(ptrs[i]);
+		};
+
+		if(ptrs[i])
+		{
+			values[i] = (char)rand_r(seed);
+			memset(ptrs[i], values[i], sizes[i]);
+		};
+	};
+
+	for(i = 0; i != THREAD_ALLOCATION_COUNT; i++)
+		mcheap_free(ptrs[i]);
+
+	return (void*)errors;
+}
+#endif
+
+static uint64_t clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Return the fraction of free space which can't be used by the largest possible allocation
+static double fragmentation(void)
+{
+	size_t total = mcheap_total_free();
+	return total ? 1.0 - (double)mcheap_largest_free()/total : 0;
+}
+
 int choose_allocation_size(void)
 {
 	int retval = 0;	